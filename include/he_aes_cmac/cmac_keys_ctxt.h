@@ -1,6 +1,9 @@
 #ifndef HEAESCMAC_CMAC_KEYS_CTXT_H
 #define HEAESCMAC_CMAC_KEYS_CTXT_H
 
+#include <istream>
+#include <ostream>
+
 #include "helib/helib.h"
 #include "cryptopp/osrng.h"
 
@@ -13,6 +16,8 @@ namespace HeAesCmac {
         std::vector<helib::Ctxt> const _aesKey;
         helib::Ctxt const _key1;
         helib::Ctxt const _key2;
+        helib::Ctxt const _packedKey1;
+        helib::Ctxt const _packedKey2;
 
         public:
             static CmacKeysCtxt genKeysCtxt(CryptoPP::RandomNumberGenerator &rng, PublicKey const &hePk);
@@ -25,13 +30,19 @@ namespace HeAesCmac {
             static void genSubKeys(std::vector<CryptoPP::byte> const &aesKey,
                                    std::vector<CryptoPP::byte> &key1,
                                    std::vector<CryptoPP::byte> &key2);
+            // Reads the ciphertexts written by write(), under hePk.
+            static CmacKeysCtxt read(std::istream &in, PublicKey const &hePk);
 
             CmacKeysCtxt(std::vector<helib::Ctxt> const &aesKey,
-                         helib::Ctxt const &key1, helib::Ctxt const &key2);
+                         helib::Ctxt const &key1, helib::Ctxt const &key2,
+                         helib::Ctxt const &packedKey1, helib::Ctxt const &packedKey2);
 
             std::vector<helib::Ctxt> const &aesKey() const;
             helib::Ctxt const &key1() const;
             helib::Ctxt const &key2() const;
+            helib::Ctxt const &packedKey1() const;
+            helib::Ctxt const &packedKey2() const;
+            void write(std::ostream &out) const;
         
         private:
             static void leftshift(std::vector<CryptoPP::byte> &data);
@@ -9,10 +9,15 @@
 #define HOM_AES_H
 
 #include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <set>
 #include "NTL/ZZX.h"
 #include "NTL/GF2X.h"
+#include "NTL/mat_GF2.h"
 #include "helib/EncryptedArray.h"
 #include "helib/hypercube.h"
+#include "helib/matmul.h"
 
 #ifdef USE_ZZX_POLY
 #define PolyType NTL::ZZX
@@ -24,17 +29,131 @@
 #endif
 #endif
 
-class HomAES {
-  const helib::EncryptedArrayDerived<helib::PA_GF2> ea2;
-
+//! The constants used by the homomorphic AES computation. These only depend
+//! on the context, so they are built once per context and shared read-only
+//! by all the HomAES objects of that context.
+struct HomAESTables {
   std::vector<PolyType> encAffMat, decAffMat; // The GF2 affine map constants
   PolyType affVec;
 
-  std::vector<PolyType> encLinTran, decLinTran; // The rowShift/colMix constants
+  //! The rowShift/colMix maps, as matrices along the first dimension that
+  //! HElib evaluates with hoisted rotations. They refer to aesEa, which
+  //! holds the slots as GF(2^8) like ea2.
+  std::shared_ptr<const helib::EncryptedArray> aesEa;
+  std::shared_ptr<const helib::MatMul1DExec> encRowCol, encRowShift;
+  std::shared_ptr<const helib::MatMul1DExec> decRowCol, decRowShift;
 
   NTL::GF2X XinSlots; // "Fully packed" poly with X in all the slots, for packing
   NTL::Mat<NTL::GF2X> unpacking; // constants for unpacking after recryption
 
+  //! Build the constants, and the packing constants if the context of ea2
+  //! is bootstrappable
+  explicit HomAESTables(const helib::EncryptedArrayDerived<helib::PA_GF2>& ea2);
+
+  //! Compute the packing/unpacking constants
+  void buildPackingConstants(const helib::Context& context);
+
+  //! An estimate of the memory taken by the constants, in bytes
+  long bytes() const;
+};
+
+//! A strategy for the GF(2^8) inversion Z -> Z^{-1} = Z^254 of ByteSub
+//! (the GF2-affine part of the S-box is applied by HomAES)
+class SBoxEngine {
+public:
+  virtual ~SBoxEngine() {}
+
+  virtual const char* name() const = 0;
+  //! The multiplicative depth of invert()
+  virtual long depth() const = 0;
+  //! The j's of the Frobenius maps Z -> Z^{2^j} of invert()
+  virtual std::vector<long> frobeniusPowers() const = 0;
+  //! In-place Z -> Z^{-1} on all the slots of c
+  virtual void invert(helib::Ctxt& c,
+		      const helib::EncryptedArrayDerived<helib::PA_GF2>& ea2) const = 0;
+};
+
+//! Z^254 = Z^240 * Z^14, from Z^3 and Z^12 using Frobenius maps in between
+//! the multiplications. Depth 3, 3 automorphisms and 4 multiplications.
+class FrobeniusChainSBox : public SBoxEngine {
+public:
+  const char* name() const override { return "frobenius-chain"; }
+  long depth() const override { return 3; }
+  std::vector<long> frobeniusPowers() const override { return {1, 2, 4}; }
+  void invert(helib::Ctxt& c,
+	      const helib::EncryptedArrayDerived<helib::PA_GF2>& ea2) const override;
+};
+
+//! Z^254 as the product of the conjugates Z^2, Z^4, ..., Z^128. The
+//! conjugates are all automorphisms of the input, computed concurrently,
+//! and multiplied in a balanced tree whose levels run on the thread pool.
+//! Depth 3 (the least possible for Z^254), 7 automorphisms and 6
+//! multiplications, but only 4 sequential steps instead of 6.
+class ConjugateProductSBox : public SBoxEngine {
+public:
+  const char* name() const override { return "conjugate-product"; }
+  long depth() const override { return 3; }
+  std::vector<long> frobeniusPowers() const override
+  { return {1, 2, 3, 4, 5, 6, 7}; }
+  void invert(helib::Ctxt& c,
+	      const helib::EncryptedArrayDerived<helib::PA_GF2>& ea2) const override;
+};
+
+//! Encodes/decodes the bytes of a single ciphertext, in the layout of
+//! encode4AES/decode4AES, without going through the CRT of all the slots.
+//! The first time a slot is used, the encodings of the 8 bits of a byte in
+//! that slot, and the map from the slot's factor back to the byte, are
+//! computed and cached. Encoding is then a sum of cached polynomials and
+//! decoding reduces the plaintext modulo the factors of the read slots only,
+//! which makes sparse data (e.g. a single block in lane 0) cheap. Data that
+//! would need more than maxSlots cached slots uses encode4AES/decode4AES.
+class AESEncoder {
+  struct SlotCode {
+    std::vector<NTL::GF2X> bits; // encoding of X^b in the slot, b=0..7
+    std::vector<long> pivots;    // coefficients mod the factor fixing the byte
+    NTL::mat_GF2 fromPivots;     // maps those coefficients to the 8 bits
+    bool decodable;
+  };
+
+  const helib::EncryptedArrayDerived<helib::PA_GF2> ea2;
+  const long maxSlots;
+
+  mutable std::mutex cacheMutex;
+  mutable std::vector<std::shared_ptr<const SlotCode>> cache;
+  mutable long nCached;
+
+  std::shared_ptr<const SlotCode> buildSlotCode(long slot) const;
+  //! The codes of the given slots, or false if they do not fit in the cache
+  bool getSlotCodes(std::vector<std::shared_ptr<const SlotCode>>& codes,
+		    const std::vector<long>& slotIdx) const;
+
+public:
+  explicit AESEncoder(const helib::EncryptedArrayDerived<helib::PA_GF2>& ea,
+		      long maxCachedSlots = 256);
+
+  //! Same as encode4AES, for at most ea.size() bytes (one ciphertext)
+  void encode(NTL::ZZX& poly, const std::vector<uint8_t>& data) const;
+  //! Same as decode4AES into nBytes <= ea.size() bytes, for one ciphertext
+  void decode(std::vector<uint8_t>& data, const NTL::ZZX& poly, long nBytes) const;
+
+  //! The number of slots whose encodings are cached
+  long cachedSlots() const;
+};
+
+class HomAES {
+  const helib::EncryptedArrayDerived<helib::PA_GF2> ea2;
+
+  // Sparse encoder, shared with the copies of this object
+  std::shared_ptr<const AESEncoder> encoder;
+
+  // The constants, shared with the other HomAES objects of the same context
+  std::shared_ptr<const HomAESTables> tables;
+
+  long nThreads; // size of the thread pool used by the AES computations
+
+  std::shared_ptr<const SBoxEngine> sbox; // the inversion of ByteSub
+
+  void invert(std::vector<helib::Ctxt>& data) const; // Z -> Z^{-1} in GF(2^8)
   void batchRecrypt(std::vector<helib::Ctxt>& data) const; // recryption during AES computation
 
 public:
@@ -47,6 +166,23 @@ public:
   //! Method for copmuting packing/unpacking constants after initialization
   void setPackingConstants();
 
+  //! Set the number of threads for the AES computations (default 1). The
+  //! ciphertexts, and the rotations/Frobenius maps of a ciphertext within
+  //! a round, are then processed on NTL's thread pool.
+  void setThreads(long n);
+  long getThreads() const { return nThreads; }
+
+  //! Size the thread pool of the calling thread to getThreads()
+  void useThreads() const;
+
+  //! Set the S-box engine used by ByteSub (default FrobeniusChainSBox)
+  void setSBox(std::shared_ptr<const SBoxEngine> engine);
+  const SBoxEngine& getSBox() const { return *sbox; }
+
+  //! Add to vals the automorphisms X -> X^k applied by homAESenc/homAESdec
+  //! with the current S-box engine, not counting those of recryption
+  void automorphisms(std::set<long>& vals) const;
+
   //! run the AES key-expansion and then encrypt the expanded key
   void encryptAESkey(std::vector<helib::Ctxt>& eKey, std::vector<uint8_t>& aesKey,
 		     const helib::PubKey& hePK) const;
@@ -64,6 +200,10 @@ public:
 
   // utility functions
   const helib::EncryptedArrayDerived<helib::PA_GF2>& getEA() const { return ea2; }
+  const AESEncoder& getEncoder() const { return *encoder; }
+  const HomAESTables& getTables() const { return *tables; }
+  //! The number of HomAES objects sharing the constants of this one
+  long getTablesUsers() const { return tables.use_count(); }
 };
 
 
@@ -73,4 +213,8 @@ void encode4AES(NTL::Vec<NTL::ZZX>& encData, const std::vector<uint8_t>& data,
 void decode4AES(std::vector<uint8_t>& data, const NTL::Vec<NTL::ZZX>& encData,
 		const helib::EncryptedArrayDerived<helib::PA_GF2>& ea2);
 
+// Add to vals the automorphisms of rotate1D by k along the i'th dimension
+void rotationAutomorphisms(std::set<long>& vals, const helib::PAlgebra& zMStar,
+			   long i, long k);
+
 #endif /* !HOM_AES_H */
\ No newline at end of file
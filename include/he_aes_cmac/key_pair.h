@@ -1,6 +1,9 @@
 #ifndef HEAESCMAC_KEY_PAIR_H
 #define HEAESCMAC_KEY_PAIR_H
 
+#include <istream>
+#include <ostream>
+
 #include "he_aes_cmac/public_key.h"
 #include "he_aes_cmac/secret_key.h"
 #include "he_aes_cmac/security_params.h"
@@ -8,20 +11,34 @@
 namespace HeAesCmac {
 
     class KeyPair {
-        PublicKey const _pk;
+        PublicKey _pk;
         SecretKey const _sk;
 
         public:
             static helib::Context genContext(SecurityParams const &params);
-            static KeyPair genKeyPair(helib::Context const &context, unsigned long hw);
+            // Binary I/O of a context, including its modulus chain and, if
+            // bootstrappable, its recryption data.
+            static void writeContext(std::ostream &out, helib::Context const &context);
+            static helib::Context readContext(std::istream &in);
+            // With minimalKeys, only the key-switching matrices of the
+            // HE-AES-CMAC computations (and of recryption) are generated.
+            static KeyPair genKeyPair(helib::Context const &context, unsigned long hw,
+                                      bool minimalKeys = false);
+
+            // Reads a key pair written by write(), for the context it was
+            // generated with. The HomAES constants are rebuilt.
+            static KeyPair read(std::istream &in, helib::Context const &context);
 
             KeyPair(PublicKey const &pk, SecretKey const &sk);
+            void write(std::ostream &out) const;
 
             PublicKey const &pk() const;
+            PublicKey &pk();
             SecretKey const &sk() const;
         
         private:
             static void genKeySwitchingMatrices(helib::SecKey &sk, unsigned long m);
+            static void genMinimalKeySwitchingMatrices(helib::SecKey &sk, HomAES const &homAes);
     };
 }
 
@@ -0,0 +1,63 @@
+#ifndef HEAESCMAC_PARAM_TUNER_H
+#define HEAESCMAC_PARAM_TUNER_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "helib/helib.h"
+#include "cryptopp/osrng.h"
+#include "he_aes_cmac/security_params.h"
+
+namespace HeAesCmac {
+
+    // A cyclotomic ring to try: m, its factorisation (empty if it cannot be
+    // bootstrapped) and the generators, with the dimension used by HomAES first.
+    struct RingCandidate {
+        long m;
+        std::vector<long> mvec;
+        std::vector<long> gens;
+        std::vector<long> ords;
+    };
+
+    struct TuningResult {
+        SecurityParams params;
+        double security;        // Estimated security level (bits).
+        long slots;             // Number of slots of the context.
+        long capacityUsed;      // Bits of capacity consumed by the trial CMAC.
+        double seconds;         // Duration of the trial CMAC.
+    };
+
+    class ParamTuner {
+
+        size_t const _maxKeyLength;
+        double const _securityLevel;
+        bool const _bootstrap;
+        std::vector<RingCandidate> const _rings;
+
+        public:
+            static std::vector<RingCandidate> defaultRings();
+
+            // Throws std::invalid_argument if maxKeyLength is 0.
+            ParamTuner(size_t maxKeyLength, double securityLevel, bool bootstrap,
+                       std::vector<RingCandidate> const &rings = defaultRings());
+
+            // Tries the candidate parameters and returns the ones with the
+            // fastest correct trial CMAC. Throws if no candidate is valid.
+            TuningResult tune(CryptoPP::RandomNumberGenerator &rng,
+                              std::ostream *log = nullptr) const;
+
+        private:
+            static std::vector<long> candidateBits(bool bootstrap);
+            // Sets reason to the check that failed, if one does.
+            bool checkContext(helib::Context const &context, double &security,
+                              std::string &reason) const;
+            bool trialCmac(CryptoPP::RandomNumberGenerator &rng,
+                           helib::Context const &context,
+                           SecurityParams const &params,
+                           TuningResult &result) const;
+    };
+}
+
+#endif /* !HEAESCMAC_PARAM_TUNER_H */
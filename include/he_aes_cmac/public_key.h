@@ -2,6 +2,8 @@
 #define HEAESCMAC_PUBLIC_KEY_H
 
 #include <cstdint>
+#include <set>
+#include <string>
 #include <vector>
 
 #include "helib/helib.h"
@@ -15,7 +17,7 @@ namespace HeAesCmac {
     class PublicKey {
 
         helib::PubKey const _pk;
-        HomAES const _heAes;
+        HomAES _heAes;
 
         public:
             PublicKey(helib::PubKey const &pk, HomAES const &heAes);
@@ -27,13 +29,56 @@ namespace HeAesCmac {
                                std::vector<helib::Ctxt> &output) const;
             void encryptBlock(std::vector<CryptoPP::byte> const &input,
                               helib::Ctxt &output) const;
+            void encryptReplicatedBlock(std::vector<CryptoPP::byte> const &input,
+                                        helib::Ctxt &output) const;
             void encryptAesKey(std::vector<CryptoPP::byte> const &key,
                                std::vector<helib::Ctxt> &output) const;
+            // A public-key encryption of zero, as costly as encrypting a
+            // block.
+            void encryptZero(helib::Ctxt &output) const;
+            // Adds a fresh encryption of zero to ctxt.
+            void rerandomize(helib::Ctxt &ctxt) const;
+            void transcipherBlocks(std::vector<helib::Ctxt> const &aesKey,
+                                   std::vector<CryptoPP::byte> const &input,
+                                   std::vector<helib::Ctxt> &output) const;
             void heAesCmac(CmacKeysCtxt const &key,
                            std::vector<helib::Ctxt> const &input,
                            bool padded,
                            helib::Ctxt &output) const;
-            
+            void heAesCmac(CmacKeysCtxt const &key,
+                           std::vector<std::vector<helib::Ctxt>> const &inputs,
+                           std::vector<bool> const &padded,
+                           std::vector<helib::Ctxt> &output) const;
+            // The same, leaving the CMAC of input i in lane i % lanes() of
+            // output[i / lanes()], for a SecretKey::decryptLanes at the PS.
+            // The lanes without an input are zero.
+            void heAesCmacPacked(CmacKeysCtxt const &key,
+                                 std::vector<std::vector<helib::Ctxt>> const &inputs,
+                                 std::vector<bool> const &padded,
+                                 std::vector<helib::Ctxt> &output) const;
+            // Mod-switches ctxt down to the fewest primes it still decrypts
+            // with, which makes it smaller to send and cheaper to decrypt.
+            void modSwitchForDecryption(helib::Ctxt &ctxt) const;
+            // modSwitchForDecryption, then helib::Ctxt::write into a string.
+            std::string serializeForDecryption(helib::Ctxt &ctxt) const;
+            long lanes() const;
+            void setThreads(long n);
+            long threads() const;
+            // Sizes the thread pool of the calling thread to threads().
+            void useThreads() const;
+            void setSBox(std::shared_ptr<const SBoxEngine> engine);
+
+            // The automorphisms X -> X^k the HE-AES-CMAC computations apply,
+            // not counting those of recryption.
+            void automorphisms(std::set<long> &vals) const;
+            // The number and size of the key-switching matrices.
+            long keySwitchingMatrices() const;
+            long keySwitchingBytes() const;
+
+        private:
+            void laneMask(std::vector<long> const &lanes, NTL::ZZX &mask) const;
+            void extractLane(helib::Ctxt const &packed, long lane, helib::Ctxt &output) const;
+            void rotateLane(helib::Ctxt &ctxt, long lane, bool inverse) const;
     };
 }
 
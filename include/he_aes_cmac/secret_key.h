@@ -1,6 +1,7 @@
 #ifndef HEAESCMAC_SECRET_KEY_H
 #define HEAESCMAC_SECRET_KEY_H
 
+#include <ostream>
 #include <vector>
 
 #include "helib/helib.h"
@@ -18,6 +19,12 @@ namespace HeAesCmac {
             void decryptBlocks(std::vector<helib::Ctxt> const &input,
                                std::vector<CryptoPP::byte> &output) const;
             void decryptBlock(helib::Ctxt const &input, std::vector<CryptoPP::byte> &output) const;
+            // Decrypts once and decodes the blocks in lanes 0 to nLanes - 1,
+            // in order, into output.
+            void decryptLanes(helib::Ctxt const &input, long nLanes,
+                              std::vector<CryptoPP::byte> &output) const;
+            // Writes the secret key, with its public part, in HElib's binary format.
+            void write(std::ostream &out) const;
 
     };
 }
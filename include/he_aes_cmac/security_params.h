@@ -14,6 +14,8 @@ namespace HeAesCmac {
         std::vector<long> mvec;   // Factorisation of m required for bootstrapping.
         std::vector<long> gens;   // Generating set of Zm* group.
         std::vector<long> ords;   // Orders of the previous generators.
+        bool bootstrap;           // Make the context bootstrappable (requires mvec).
+        bool minimalKeys;         // Only generate the key-switching matrices HE-AES-CMAC uses.
     };
 }
 
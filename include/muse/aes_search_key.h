@@ -0,0 +1,23 @@
+#ifndef MUSE_AES_SEARCH_KEY_H
+#define MUSE_AES_SEARCH_KEY_H
+
+#include <vector>
+
+#include "cryptopp/config_int.h"
+
+namespace muse {
+    // A search key encrypted with AES-ECB under the client's transciphering
+    // key, padded to whole blocks like SearchKeyCtxt.
+    class AesSearchKey {
+        std::vector<CryptoPP::byte> _blocks;
+        bool _padded;
+
+        public:
+            AesSearchKey(std::vector<CryptoPP::byte> const &blocks, bool padded);
+
+            std::vector<CryptoPP::byte> const &blocks() const;
+            bool isPadded() const;
+    };
+}
+
+#endif /* !MUSE_AES_SEARCH_KEY_H */
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef MUSE_BOUNDED_QUEUE_H
+#define MUSE_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace muse {
+    // A blocking FIFO queue with a maximum size, shared by producer and
+    // consumer threads. Once closed, pushes fail and pops drain what is left.
+    template <typename T>
+    class BoundedQueue {
+        size_t const _capacity;
+        std::deque<T> _items;
+        bool _closed;
+        std::mutex _mutex;
+        std::condition_variable _notFull;
+        std::condition_variable _notEmpty;
+
+        public:
+            explicit BoundedQueue(size_t capacity):
+                _capacity(capacity == 0 ? 1 : capacity),
+                _closed(false)
+            {}
+
+            // Waits while the queue is full. Returns false if it is closed.
+            bool push(T item) {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _notFull.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+                if (_closed) {
+                    return false;
+                }
+                _items.push_back(std::move(item));
+                _notEmpty.notify_one();
+                return true;
+            }
+
+            // Waits while the queue is empty. Returns false once it is
+            // closed and empty.
+            bool pop(T &item) {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _notEmpty.wait(lock, [this] { return _closed || !_items.empty(); });
+                return popLocked(item);
+            }
+
+            // Returns false at once if the queue is empty.
+            bool tryPop(T &item) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                return popLocked(item);
+            }
+
+            void close() {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closed = true;
+                _notFull.notify_all();
+                _notEmpty.notify_all();
+            }
+
+        private:
+            bool popLocked(T &item) {
+                if (_items.empty()) {
+                    return false;
+                }
+                item = std::move(_items.front());
+                _items.pop_front();
+                _notFull.notify_one();
+                return true;
+            }
+    };
+}
+
+#endif /* !MUSE_BOUNDED_QUEUE_H */
\ No newline at end of file
@@ -1,11 +1,16 @@
 #ifndef MUSE_CLIENT_H
 #define MUSE_CLIENT_H
 
+#include <future>
+#include <memory>
+#include <thread>
 #include <vector>
 #include <string>
 #include <stdexcept>
 
+#include "muse/bounded_queue.h"
 #include "muse/data_storage_service.h"
+#include "muse/search_key_cache.h"
 #include "pre/key_pair.h"
 
 namespace muse {
@@ -14,20 +19,53 @@ namespace muse {
         size_t const _searchKeyLength;
         pre::KeyPair const _preKeys;
         DataStorageService &_ds;
+        std::vector<CryptoPP::byte> _aesKey;  // Empty unless transciphering.
+        SearchKeyCache _searchKeyCache;
+        bool _rerandomize;
+        // With rerandomize, encryptions of zero made ahead by _zeroEncrypter.
+        std::unique_ptr<BoundedQueue<helib::Ctxt>> _zeros;
+        std::thread _zeroEncrypter;
 
         public:
+            // The number of encryptions of zero kept ready for rerandomizing.
+            static size_t const ZERO_POOL_SIZE = 64;
+
             Client(size_t id, size_t searchKeyLength, DataStorageService &ds);
+            ~Client();
 
             pre::PublicKey const &prePk() const;
 
             void grantAccess(size_t toId, pre::PublicKey const &toPk);
             void revokeAccess(size_t toId);
 
+            // From now on, send the search keys encrypted with AES under
+            // aesKey, instead of HE encrypted. The DSS recovers their HE
+            // encryption with the registered HE encryption of aesKey.
+            void useTranscipher(std::vector<CryptoPP::byte> const &aesKey);
+
+            // Keep up to capacity HE encrypted search keys for reuse (0, the
+            // default, disables the cache). With rerandomize, an encryption
+            // of zero is added to a cached ciphertext before it is sent, so
+            // that repeated uploads are not identical. These are encrypted
+            // ahead by a background thread, so a hit only costs an addition.
+            // When the pool runs dry, a hit costs as much as a miss.
+            void setSearchKeyCache(size_t capacity, bool rerandomize = false);
+            SearchKeyCache const &searchKeyCache() const;
+
             void store(std::vector<std::string> const &searchKeys, CryptoPP::Integer const &data);
+            // See DataStorageService::storeAsync. With transciphering, the
+            // document is stored before this returns.
+            std::future<void> storeAsync(std::vector<std::string> const &searchKeys,
+                                         CryptoPP::Integer const &data);
             std::vector<CryptoPP::Integer> search(std::string const &searchKey);
         
         private:
             SearchKeyCtxt encryptSearchKey(std::string const &ptxt) const;
+            SearchKeyCtxt cachedSearchKey(std::string const &ptxt);
+            AesSearchKey aesEncryptSearchKey(std::string const &ptxt) const;
+            void rerandomize(helib::Ctxt &ctxt);
+            void encryptZeros();
+            void stopZeroPool();
     };
 }
 
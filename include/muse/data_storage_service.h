@@ -1,18 +1,40 @@
 #ifndef MUSE_DATA_STORAGE_SERVICE_H
 #define MUSE_DATA_STORAGE_SERVICE_H
 
+#include <array>
+#include <atomic>
+#include <future>
+#include <istream>
 #include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 #include "muse/privacy_service.h"
 #include "muse/search_key_ctxt.h"
+#include "muse/aes_search_key.h"
+#include "muse/bounded_queue.h"
+#include "muse/document_store.h"
+#include "muse/grant_log.h"
+#include "muse/hash_pipeline.h"
+#include "muse/inverted_index.h"
+#include "muse/reencryption_cache.h"
 #include "he_aes_cmac/cmac_keys_ctxt.h"
 #include "pre/pre_scheme.h"
 #include "pre/public_key.h"
 #include "pre/reencryption_key.h"
 #include "pre/primary_ctxt.h"
+#include "pre/reencrypted_ctxt.h"
 
 namespace muse {
+    // Stores and searches may be called from many threads at once. Of the
+    // setup methods, openStorage and checkpoint may run alongside them, the
+    // hash pipeline and re-encryption cache ones may not.
     class DataStorageService {
 
         struct Document {
@@ -22,17 +44,99 @@ namespace muse {
             Document(size_t authId, pre::PrimaryCtxt const &ctxt);
         };
 
+        // The tables are split in shards with a lock each, so that stores
+        // and searches of different clients rarely wait for each other.
+        static size_t const SHARDS = 16;
+
+        struct IndexShard {
+            mutable std::shared_mutex _mutex;
+            // Search-key hash, for an owner (see Digest::forOwner) ->
+            // document IDs of the owner.
+            InvertedIndex _index;
+        };
+
+        struct DocumentShard {
+            mutable std::shared_mutex _mutex;
+            std::unordered_map<size_t, Document> _documents;
+        };
+
+        // A re-encryption key, with a number that is different for every
+        // grant, so that cached re-encryptions are tied to the grant.
+        struct Grant {
+            pre::ReencryptionKey _reKey;
+            uint64_t _version;
+        };
+
+        struct ReKeyShard {
+            mutable std::shared_mutex _mutex;
+            std::unordered_map<size_t,
+                std::unordered_map<size_t, std::shared_ptr<Grant const>>> _reKeyTable;
+        };
+
+        // The owners that granted each recipient access, so that a search
+        // only looks up the posting lists it may read.
+        struct GrantorShard {
+            mutable std::shared_mutex _mutex;
+            std::unordered_map<size_t, std::unordered_set<size_t>> _grantors;
+        };
+
         HeAesCmac::CmacKeysCtxt const _hashKey;
         pre::PreScheme _preScheme;
         PrivacyService const &_ps;
-        std::unordered_multimap<std::string, Document> _storage;
-        std::unordered_map<size_t, std::unordered_map<size_t, pre::ReencryptionKey>> _reKeyTable;
+        std::array<IndexShard, SHARDS> _indexShards;        // By digest.
+        std::array<DocumentShard, SHARDS> _documentShards;  // By document ID.
+        std::array<ReKeyShard, SHARDS> _reKeyShards;        // By owner ID.
+        std::array<GrantorShard, SHARDS> _grantorShards;    // By recipient ID.
+        std::atomic<uint64_t> _grantVersion;
+        // Held to grant and revoke, so that the tables and the grant log
+        // see them in the same order. Taken before _storageMutex.
+        std::mutex _grantMutex;
+        ReencryptionCache _reencryptionCache;
+        // With precomputation, the grants whose re-encryptions are to be
+        // cached in the background, as (owner, recipient). Unbounded, so
+        // that grantAccess never waits for the precomputation.
+        std::unique_ptr<BoundedQueue<std::pair<size_t, size_t>>> _grantJobs;
+        std::thread _precomputer;
+        std::atomic<size_t> _nextDocumentId;
+        // With openStorage(), the documents are on disk instead of in
+        // _documentShards, and the index shards only hold those added since
+        // the saved index. Held exclusively to open and checkpoint storage.
+        mutable std::shared_mutex _storageMutex;
+        std::string _storageDirectory;
+        std::unique_ptr<DocumentStore> _documentStore;
+        std::unique_ptr<FrozenIndex> _frozenIndex;
+        std::unique_ptr<GrantLog> _grantLog;
+        mutable std::shared_mutex _transcipherMutex;
+        std::unordered_map<size_t, std::vector<helib::Ctxt>> _transcipherKeys;
+        std::unique_ptr<HashPipeline> _hashPipeline;
 
         public:
             DataStorageService(size_t preK1, size_t preK2, size_t preKp,
                                CryptoPP::RandomNumberGenerator &rng, PrivacyService const &ps);
             DataStorageService(size_t preK1, size_t preK2, size_t preKp,
                                std::vector<CryptoPP::byte> const &hashKey, PrivacyService const &ps);
+            // Uses the encrypted hash key saved by writeHashKey(), instead of
+            // encrypting a new one.
+            DataStorageService(size_t preK1, size_t preK2, size_t preKp,
+                               std::istream &hashKey, PrivacyService const &ps);
+
+            ~DataStorageService();
+
+            void writeHashKey(std::ostream &out) const;
+
+            // Keeps the documents in append-only segment files in directory,
+            // read through mmap, and uses the index saved there by the last
+            // checkpoint(). The documents stored since are indexed again from
+            // their records, so a restarted DSS serves everything it stored;
+            // a saved index it cannot load is dropped and rebuilt likewise.
+            // Grants are saved there too as they are made, and those saved
+            // before are restored. Must be called before any document is
+            // stored in memory.
+            void openStorage(std::string const &directory);
+            // Flushes the documents and saves the index, to be loaded by mmap
+            // on the next openStorage().
+            void checkpoint();
+            size_t documentCount() const;
 
             pre::PreScheme &preScheme();
             HeAesCmac::PublicKey const &hePk() const;
@@ -40,14 +144,76 @@ namespace muse {
             void grantAccess(size_t fromId, size_t toId, pre::ReencryptionKey const &reKey);
             void revokeAccess(size_t fromId, size_t toId);
 
+            // Keep up to capacity re-encrypted documents for reuse by later
+            // searches of the same recipient (0, the default, disables the
+            // cache). With precomputeOnGrant, each grantAccess also starts
+            // re-encrypting the newest documents of the grantor for the
+            // recipient in the background, up to a quarter of the capacity
+            // per grant, so that one grant does not evict the others.
+            void setReencryptionCache(size_t capacity, bool precomputeOnGrant = false);
+            ReencryptionCache const &reencryptionCache() const;
+
+            // Registers the HE encryption of the client's AES key (see
+            // HeAesCmac::PublicKey::encryptAesKey), needed to store and
+            // search with AES encrypted search keys.
+            void registerTranscipherKey(size_t clientId, std::vector<helib::Ctxt> const &aesKey);
+
+            // Computes the hashes of the search keys on a HashPipeline, so
+            // that the CMACs of a document are evaluated while the PS hashes
+            // those of the previous one. queueCapacity bounds the search keys
+            // waiting for each stage, psRequests the concurrent PS requests.
+            void enableHashPipeline(size_t queueCapacity, size_t psRequests = 1);
+            void disableHashPipeline();
+
+            // Throws if the proof of ctxt is invalid. It is only checked
+            // here, not again on each access.
             void store(size_t clientId,
                        std::vector<SearchKeyCtxt> const &searchKeys,
                        pre::PrimaryCtxt const &ctxt);
             std::vector<std::unique_ptr<pre::Ctxt>> search(size_t clientId,
                                                            SearchKeyCtxt const &searchKey);
+            // Submits the search keys to the hash pipeline and returns once
+            // they are queued. The document is stored by the pipeline once
+            // its hashes are known, and the returned future is then ready
+            // (or holds the error). disableHashPipeline and the destructor
+            // wait for the pending stores. Stores synchronously if the
+            // pipeline is not enabled.
+            std::future<void> storeAsync(size_t clientId,
+                                         std::vector<SearchKeyCtxt> const &searchKeys,
+                                         pre::PrimaryCtxt const &ctxt);
+            void store(size_t clientId,
+                       std::vector<AesSearchKey> const &searchKeys,
+                       pre::PrimaryCtxt const &ctxt);
+            std::vector<std::unique_ptr<pre::Ctxt>> search(size_t clientId,
+                                                           AesSearchKey const &searchKey);
 
         private:
+            static size_t shard(Digest const &digest);
+            // Update the tables only, the caller holds _grantMutex.
+            void addGrant(size_t fromId, size_t toId, pre::ReencryptionKey const &reKey);
+            void removeGrant(size_t fromId, size_t toId);
+            void addDocument(size_t clientId, pre::PrimaryCtxt const &ctxt,
+                             std::vector<std::string> const &hashes);
+            // Null if toId has no access to the documents of fromId.
+            std::shared_ptr<Grant const> findGrant(size_t fromId, size_t toId) const;
+            std::shared_ptr<pre::ReencryptedCtxt const> reencrypt(size_t documentId, size_t ownerId,
+                                                                  size_t recipientId,
+                                                                  Grant const &grant,
+                                                                  std::unique_ptr<pre::PrimaryCtxt> &loaded);
+            std::vector<size_t> grantors(size_t recipientId) const;
+            std::vector<size_t> ownedDocuments(size_t ownerId) const;
+            void precompute();
+            void stopPrecomputation();
+            std::vector<size_t> documentIds(Digest const &digest) const;
+            pre::PrimaryCtxt const &documentCtxt(size_t documentId,
+                                                 std::unique_ptr<pre::PrimaryCtxt> &loaded) const;
             void computeHash(SearchKeyCtxt const &input, std::string &output) const;
+            void requestHash(helib::Ctxt &hashCtxt, std::string &output) const;
+            void computeHashes(std::vector<SearchKeyCtxt> const &input,
+                               std::vector<std::string> &output) const;
+            void transcipher(size_t clientId,
+                             std::vector<AesSearchKey> const &input,
+                             std::vector<SearchKeyCtxt> &output) const;
     };
 }
 
@@ -0,0 +1,79 @@
+#ifndef MUSE_DOCUMENT_STORE_H
+#define MUSE_DOCUMENT_STORE_H
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "muse/inverted_index.h"
+#include "muse/mapped_file.h"
+#include "pre/primary_ctxt.h"
+
+namespace muse {
+    // Append-only, disk-backed storage of the documents of a DSS. Each
+    // document is a checksummed record in a segment file of the directory,
+    // holding its owner, its search-key digests and its serialized
+    // PrimaryCtxt; its ID is its record number. Records are read through a
+    // memory mapping of the segment, so only the pages of the documents
+    // served are brought in. Documents may be read while others are
+    // appended.
+    class DocumentStore {
+
+        struct Location {
+            uint32_t _segment;
+            uint64_t _offset;
+            uint64_t _size;     // With the size field.
+            size_t _authId;
+        };
+
+        // Held exclusively to append and to map a segment again.
+        mutable std::shared_mutex _mutex;
+
+        std::string const _directory;
+        uint64_t const _segmentBytes;
+        std::vector<Location> _locations;
+        mutable std::vector<std::unique_ptr<MappedFile>> _segments;
+        int _fd;                // The last segment, opened for appending.
+        uint64_t _activeSize;
+
+        public:
+            static uint64_t const DEFAULT_SEGMENT_BYTES = uint64_t(1) << 30;
+
+            // Opens the store in directory, creating it if needed. A record
+            // left incomplete by a crash at the end of the last segment is
+            // dropped; a corrupt record elsewhere throws std::runtime_error.
+            explicit DocumentStore(std::string const &directory,
+                                   uint64_t segmentBytes = DEFAULT_SEGMENT_BYTES);
+            ~DocumentStore();
+
+            DocumentStore(DocumentStore const &) = delete;
+            DocumentStore &operator=(DocumentStore const &) = delete;
+
+            // Returns the ID of the new document. The ciphertext must have
+            // been validated, and is read back as such.
+            size_t append(size_t authId, std::vector<Digest> const &digests,
+                          pre::PrimaryCtxt const &ctxt);
+            // Flushes the appended documents to disk.
+            void sync();
+
+            size_t size() const;
+            size_t authId(size_t documentId) const;
+            std::vector<Digest> digests(size_t documentId) const;
+            pre::PrimaryCtxt read(size_t documentId) const;
+
+        private:
+            std::string segmentPath(size_t segment) const;
+            void openSegment(size_t segment);
+            // Returns the size of the complete records of the segment.
+            uint64_t scanSegment(size_t segment, bool last);
+            // Locks the store with the record of the document mapped.
+            std::shared_lock<std::shared_mutex> lockRecord(size_t documentId) const;
+            // The record, after its size field, under lockRecord(). Throws
+            // std::runtime_error if its checksum does not match.
+            char const *record(size_t documentId, uint64_t &size) const;
+    };
+}
+
+#endif /* !MUSE_DOCUMENT_STORE_H */
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef MUSE_FILE_IO_H
+#define MUSE_FILE_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+#include <string>
+
+#include "cryptopp/crc.h"
+
+namespace muse {
+    // Flushes the file or directory at path to disk, so that what was
+    // written to it, or the entries created or renamed in it, survive a
+    // crash. Throws std::runtime_error on failure.
+    void syncPath(std::string const &path);
+
+    // Writes all of data to fd. On failure, truncates the file back to
+    // restoreSize, so that it stays a sequence of complete records, and
+    // throws std::runtime_error.
+    void writeRecord(int fd, std::string const &data, uint64_t restoreSize,
+                     std::string const &path);
+
+    // The checksum of a record, to tell a torn or corrupt record from a
+    // complete one.
+    uint64_t recordChecksum(char const *data, size_t size);
+
+    // Computes the recordChecksum() of what is written through it, for
+    // data too large to be built in memory first.
+    class ChecksumBuffer : public std::streambuf {
+        CryptoPP::CRC32C _crc;
+
+        public:
+            // The checksum of what was written so far. Starts over.
+            uint64_t checksum();
+
+        protected:
+            std::streamsize xsputn(char const *data, std::streamsize size) override;
+            int_type overflow(int_type c) override;
+    };
+}
+
+#endif /* !MUSE_FILE_IO_H */
\ No newline at end of file
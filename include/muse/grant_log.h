@@ -0,0 +1,54 @@
+#ifndef MUSE_GRANT_LOG_H
+#define MUSE_GRANT_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "pre/reencryption_key.h"
+
+namespace muse {
+    // The grants of a DSS, kept in a file of its storage directory so that
+    // a reopened DSS still lets recipients search the documents shared with
+    // them. Each grant and revocation is a checksummed record appended to
+    // the file and synced before it returns.
+    class GrantLog {
+        public:
+            // (owner, recipient) -> re-encryption key.
+            typedef std::map<std::pair<size_t, size_t>, pre::ReencryptionKey> Grants;
+
+        private:
+            std::mutex _mutex;
+            std::string const _path;
+            int _fd;
+            uint64_t _size;
+            Grants _grants;
+
+        public:
+            // Opens the log at path, creating it if needed. A record left
+            // incomplete by a crash is dropped, and the log is rewritten
+            // with only the grants in force, so it does not grow with the
+            // revoked ones.
+            explicit GrantLog(std::string const &path);
+            ~GrantLog();
+
+            GrantLog(GrantLog const &) = delete;
+            GrantLog &operator=(GrantLog const &) = delete;
+
+            // The grants in force when the log was opened.
+            Grants const &grants() const;
+
+            void grant(size_t fromId, size_t toId, pre::ReencryptionKey const &reKey);
+            void revoke(size_t fromId, size_t toId);
+
+        private:
+            void load();
+            void compact();
+            void append(std::string const &payload);
+    };
+}
+
+#endif /* !MUSE_GRANT_LOG_H */
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef MUSE_HASH_PIPELINE_H
+#define MUSE_HASH_PIPELINE_H
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "muse/bounded_queue.h"
+#include "muse/privacy_service.h"
+#include "muse/search_key_ctxt.h"
+#include "he_aes_cmac/cmac_keys_ctxt.h"
+
+namespace muse {
+    // Computes search-key hashes in two stages connected by a bounded queue:
+    // a producer thread evaluates the HE-AES-CMACs, batching whatever search
+    // keys are waiting (up to one per lane), and consumer threads run the
+    // PrivacyService part. The CMACs of later search keys are thus evaluated
+    // while the PS handles earlier ones.
+    class HashPipeline {
+
+        public:
+            using Done = std::function<void(std::vector<std::string> const &)>;
+            using Failed = std::function<void(std::exception_ptr)>;
+
+        private:
+            // The search keys submitted together, and what to do with their
+            // hashes once they are all known.
+            struct Group {
+                std::vector<std::string> _hashes;
+                std::atomic<size_t> _remaining;
+                std::atomic<bool> _failed;
+                Done _done;
+                Failed _onFailure;
+
+                Group(size_t size, Done done, Failed onFailure);
+            };
+
+            struct Slot {
+                std::shared_ptr<Group> _group;
+                size_t _index;
+            };
+
+            struct Job {
+                std::vector<helib::Ctxt> _blocks;
+                bool _padded;
+                Slot _slot;
+            };
+
+            // A packed ciphertext of CMACs, as sent to the PS, one per slot.
+            struct Request {
+                std::string _message;
+                std::vector<Slot> _slots;
+            };
+
+            HeAesCmac::CmacKeysCtxt const &_hashKey;
+            PrivacyService const &_ps;
+            BoundedQueue<Job> _jobs;
+            BoundedQueue<Request> _requests;
+            std::thread _producer;
+            std::vector<std::thread> _consumers;
+
+        public:
+            // At most queueCapacity search keys wait for each stage.
+            HashPipeline(HeAesCmac::CmacKeysCtxt const &hashKey, PrivacyService const &ps,
+                         size_t queueCapacity, size_t consumers = 1);
+            // Finishes the submitted search keys, calling their callbacks.
+            ~HashPipeline();
+
+            HashPipeline(HashPipeline const &) = delete;
+            HashPipeline &operator=(HashPipeline const &) = delete;
+
+            // Calls done with the hashes of the search keys, in order, on the
+            // pipeline thread that computes the last of them, or onFailure
+            // with the first error (also if done throws). Waits if the first
+            // stage is full; neither is called if this throws.
+            void submit(std::vector<SearchKeyCtxt> const &searchKeys,
+                        Done done, Failed onFailure);
+            std::future<std::string> submit(SearchKeyCtxt const &searchKey);
+
+        private:
+            void produce();
+            void consume();
+            static void setHash(Slot const &slot, std::string const &hash);
+            static void fail(Slot const &slot, std::exception_ptr error);
+    };
+}
+
+#endif /* !MUSE_HASH_PIPELINE_H */
\ No newline at end of file
@@ -0,0 +1,115 @@
+#ifndef MUSE_INVERTED_INDEX_H
+#define MUSE_INVERTED_INDEX_H
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "muse/mapped_file.h"
+
+namespace muse {
+    // A search-key hash (a CMAC output), stored inline.
+    struct Digest {
+        static size_t const SIZE = 16;
+
+        std::array<uint8_t, SIZE> _bytes;
+
+        // Throws if hash is not SIZE bytes long.
+        static Digest fromString(std::string const &hash);
+
+        // The key of the posting list of the documents of one owner. The
+        // lists of different owners are as unlikely to share a key as two
+        // search keys are to share a digest.
+        Digest forOwner(uint64_t ownerId) const;
+
+        bool operator==(Digest const &other) const;
+        // The digest is pseudorandom, so its first bytes are a good hash.
+        uint64_t hash() const;
+    };
+
+    // Maps each digest to the list of the IDs of the documents it indexes, in
+    // insertion order. The digests are kept in an open-addressing table whose
+    // slots are probed in groups of 16 by comparing a 7-bit tag of the hash
+    // in one SSE2 instruction, and each posting list is a contiguous vector.
+    class InvertedIndex {
+
+        std::vector<uint8_t> _control;  // Tag of each slot, or EMPTY.
+        std::vector<Digest> _keys;
+        std::vector<uint32_t> _lists;   // Posting list of each slot.
+        std::vector<std::vector<size_t>> _postings;
+        size_t _postingCount;
+
+        public:
+            InvertedIndex();
+
+            // Adds documentId to the posting list of key, unless it is
+            // already the last one.
+            void append(Digest const &key, size_t documentId);
+            // The same for all the keys of a document, growing the table once.
+            void append(std::vector<Digest> const &keys, size_t documentId);
+
+            // Empty if key is not indexed.
+            std::vector<size_t> const &postings(Digest const &key) const;
+
+            // Appends all the posting lists of other, key by key.
+            void append(InvertedIndex const &other);
+
+            // Makes room for the given number of distinct keys.
+            void reserve(size_t keys);
+
+            // Saves the index in the format of FrozenIndex, recording that
+            // it covers the documents with IDs below documents.
+            void write(std::ostream &out, size_t documents) const;
+
+            size_t size() const;            // Number of distinct keys.
+            size_t postingCount() const;
+            size_t memoryBytes() const;
+
+        private:
+            size_t groups() const;
+            // The saved index after its header.
+            void writeBody(std::ostream &out) const;
+            // The slot holding key, or the first empty one of its probe
+            // sequence if found is false.
+            size_t findSlot(Digest const &key, uint64_t hash, bool &found) const;
+            void rehash(size_t groups);
+    };
+
+    // An index saved by InvertedIndex::write, used in place through a
+    // read-only memory mapping of the file: loading it does not rebuild
+    // the table. It is read once on loading, to check it against its
+    // checksum, as a damaged table could send lookups outside the mapping
+    // or around it forever.
+    class FrozenIndex {
+        MappedFile _file;
+        size_t _groups;
+        size_t _size;
+        size_t _postingCount;
+        size_t _documents;
+        uint8_t const *_control;
+        Digest const *_keys;
+        uint64_t const *_lists;     // Posting list of each slot.
+        uint64_t const *_offsets;   // Start of each posting list, and the end.
+        uint64_t const *_postings;
+
+        public:
+            // Throws std::runtime_error if the file is not a saved index, or
+            // a damaged one.
+            explicit FrozenIndex(std::string const &path);
+
+            // The index covers the documents with IDs below this.
+            size_t documents() const;
+            size_t size() const;
+            size_t postingCount() const;
+
+            // The posting list of key, empty if it is not indexed.
+            std::pair<uint64_t const *, uint64_t const *> postings(Digest const &key) const;
+
+            void appendTo(InvertedIndex &index) const;
+    };
+}
+
+#endif /* !MUSE_INVERTED_INDEX_H */
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef MUSE_MAPPED_FILE_H
+#define MUSE_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+namespace muse {
+    // A whole file, memory-mapped read-only.
+    class MappedFile {
+        std::string const _path;
+        char const *_data;
+        size_t _size;
+
+        public:
+            // Throws std::runtime_error if the file cannot be mapped.
+            explicit MappedFile(std::string const &path);
+            ~MappedFile();
+
+            MappedFile(MappedFile const &) = delete;
+            MappedFile &operator=(MappedFile const &) = delete;
+
+            // Maps the file again, after it has grown.
+            void remap();
+
+            char const *data() const;
+            size_t size() const;
+
+        private:
+            void map();
+            void unmap();
+    };
+}
+
+#endif /* !MUSE_MAPPED_FILE_H */
\ No newline at end of file
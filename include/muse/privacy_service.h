@@ -1,12 +1,15 @@
 #ifndef MUSE_PRIVACY_SERVICE_H
 #define MUSE_PRIVACY_SERVICE_H
 
+#include <istream>
+#include <ostream>
+
 #include "he_aes_cmac/key_pair.h"
 
 namespace muse {
     class PrivacyService {
         helib::Context const _heContext;
-        HeAesCmac::KeyPair const _heKeys;
+        HeAesCmac::KeyPair _heKeys;
         std::vector<CryptoPP::byte> const _hashKey;
 
         public:
@@ -14,12 +17,36 @@ namespace muse {
                            HeAesCmac::SecurityParams const &heParams);
             PrivacyService(std::vector<CryptoPP::byte> const &hashKey,
                            HeAesCmac::SecurityParams const &heParams);
+            // Restores a PrivacyService saved by write(), with the same
+            // context, HE keys and hash key.
+            explicit PrivacyService(std::istream &in);
+
+            void write(std::ostream &out) const;
 
             HeAesCmac::PublicKey const &hePk() const;
+            void setHeThreads(long n);
+            void setHeSBox(std::shared_ptr<const SBoxEngine> engine);
             void computeHash(helib::Ctxt const &input, std::string &output) const;
+            // The same, for a ciphertext serialized with helib::Ctxt::write,
+            // as the DSS sends it.
+            void computeHash(std::string const &input, std::string &output) const;
+            // Hashes many CMACs with a single AES key schedule: one per
+            // ciphertext, in lane 0, or count of them in lanes 0 to count - 1
+            // of one packed ciphertext (see HeAesCmac::PublicKey::heAesCmacPacked),
+            // which is decrypted only once.
+            void computeHashBatch(std::vector<helib::Ctxt> const &input,
+                                  std::vector<std::string> &output) const;
+            void computeHashBatch(helib::Ctxt const &packed, size_t count,
+                                  std::vector<std::string> &output) const;
+            void computeHashBatch(std::string const &packed, size_t count,
+                                  std::vector<std::string> &output) const;
         
         private:
+            helib::Ctxt readCtxt(std::string const &input) const;
+            void hashBlocks(std::vector<CryptoPP::byte> const &blocks,
+                            std::vector<std::string> &output) const;
             static std::vector<CryptoPP::byte> genAesKey(CryptoPP::RandomNumberGenerator &rng);
+            static std::vector<CryptoPP::byte> readAesKey(std::istream &in);
     };
 }
 
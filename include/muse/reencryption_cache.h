@@ -0,0 +1,69 @@
+#ifndef MUSE_REENCRYPTION_CACHE_H
+#define MUSE_REENCRYPTION_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "pre/reencrypted_ctxt.h"
+
+namespace muse {
+    // A bounded, thread-safe LRU cache of the re-encryptions of documents
+    // for their recipients. Each entry records the version of the grant it
+    // was computed under, and is only returned for that version, so a
+    // re-encryption made just before a revocation is never served after it.
+    class ReencryptionCache {
+
+        typedef std::pair<size_t, size_t> Key;  // Document and recipient IDs.
+
+        struct KeyHash {
+            size_t operator()(Key const &key) const;
+        };
+
+        struct Entry {
+            Key _key;
+            size_t _ownerId;
+            uint64_t _version;
+            std::shared_ptr<pre::ReencryptedCtxt const> _ctxt;
+        };
+
+        typedef std::list<Entry> EntryList;
+
+        mutable std::mutex _mutex;
+        size_t _capacity;
+        EntryList _entries;     // Most recently used first.
+        std::unordered_map<Key, EntryList::iterator, KeyHash> _index;
+        size_t _hits;
+        size_t _misses;
+
+        public:
+            explicit ReencryptionCache(size_t capacity = 0);
+
+            size_t capacity() const;
+            // Evicts the least recently used entries that no longer fit.
+            void setCapacity(size_t capacity);
+
+            // Returns null if there is no entry for this grant version.
+            // Counts a hit or a miss.
+            std::shared_ptr<pre::ReencryptedCtxt const> find(size_t documentId, size_t recipientId,
+                                                             uint64_t version);
+            // The same, without counting nor refreshing the entry.
+            bool contains(size_t documentId, size_t recipientId, uint64_t version) const;
+            void insert(size_t documentId, size_t recipientId, size_t ownerId, uint64_t version,
+                        std::shared_ptr<pre::ReencryptedCtxt const> ctxt);
+            // Drops the entries of the documents of ownerId for recipientId.
+            void invalidate(size_t ownerId, size_t recipientId);
+
+            size_t size() const;
+            size_t hits() const;
+            size_t misses() const;
+
+        private:
+            void erase(EntryList::iterator it);
+    };
+}
+
+#endif /* !MUSE_REENCRYPTION_CACHE_H */
\ No newline at end of file
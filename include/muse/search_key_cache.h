@@ -0,0 +1,39 @@
+#ifndef MUSE_SEARCH_KEY_CACHE_H
+#define MUSE_SEARCH_KEY_CACHE_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "muse/search_key_ctxt.h"
+
+namespace muse {
+    // A bounded LRU cache of encrypted search keys, by plaintext search key.
+    class SearchKeyCache {
+        typedef std::list<std::pair<std::string, SearchKeyCtxt>> EntryList;
+
+        size_t _capacity;
+        EntryList _entries;     // Most recently used first.
+        std::unordered_map<std::string, EntryList::iterator> _index;
+        size_t _hits;
+        size_t _misses;
+
+        public:
+            explicit SearchKeyCache(size_t capacity = 0);
+
+            size_t capacity() const;
+            // Evicts the least recently used entries that no longer fit.
+            void setCapacity(size_t capacity);
+
+            // Returns nullptr if the key is not cached. Counts a hit or a miss.
+            SearchKeyCtxt const *find(std::string const &searchKey);
+            void insert(std::string const &searchKey, SearchKeyCtxt const &ctxt);
+
+            size_t size() const;
+            size_t hits() const;
+            size_t misses() const;
+    };
+}
+
+#endif /* !MUSE_SEARCH_KEY_CACHE_H */
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef PRE_INTEGER_IO_H
+#define PRE_INTEGER_IO_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+#include "cryptopp/integer.h"
+
+namespace pre {
+    // Fixed-width and length-prefixed binary encodings, in host byte order,
+    // for saving keys and ciphertexts. The readers throw std::runtime_error
+    // on truncated input.
+    void writeUint64(std::ostream &out, uint64_t value);
+    uint64_t readUint64(std::istream &in);
+    void writeInteger(std::ostream &out, CryptoPP::Integer const &value);
+    CryptoPP::Integer readInteger(std::istream &in);
+}
+
+#endif /* !PRE_INTEGER_IO_H */
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef PRE_SCHEME_H
 #define PRE_SCHEME_H
 
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
 #include "cryptopp/integer.h"
@@ -26,7 +28,14 @@ namespace pre {
         static CryptoPP::Integer integerConcat(std::vector<CryptoPP::Integer> args);
         static CryptoPP::Integer generateSafePrime(CryptoPP::AutoSeededRandomPool &rng, size_t bitSize);
 
-        CryptoPP::AutoSeededRandomPool _rng;
+        // One pool per thread, so that clients can encrypt concurrently.
+        static CryptoPP::AutoSeededRandomPool &rng();
+
+        // Proof checks of PrimaryCtxt::validate, and those skipped because
+        // the ciphertext had already passed.
+        mutable std::atomic<uint64_t> _validations;
+        mutable std::atomic<uint64_t> _skippedValidations;
+
         size_t const _k1;
         size_t const _k2;
         size_t const _kp;
@@ -39,6 +48,12 @@ namespace pre {
             PrimaryCtxt encrypt(CryptoPP::Integer const &m, PublicKey const &pk);
             ReencryptedCtxt reencrypt(PrimaryCtxt const &ctxt, ReencryptionKey const &rk);
             CryptoPP::Integer decrypt(Ctxt const &ctxt, PublicKey const &pk, SecretKey const &sk);
+
+            // Each check costs VALIDATION_EXPONENTIATIONS exponentiations
+            // modulo N^2 (and two inversions for a negative s).
+            static unsigned const VALIDATION_EXPONENTIATIONS = 4;
+            uint64_t validations() const;
+            uint64_t skippedValidations() const;
     };
 }
 
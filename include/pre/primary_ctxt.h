@@ -1,8 +1,16 @@
 #ifndef PRE_PRIMARY_CTXT_H
 #define PRE_PRIMARY_CTXT_H
 
+#include <atomic>
+#include <istream>
+#include <ostream>
+
 #include "pre/ctxt.h"
 
+namespace muse {
+    class DocumentStore;
+}
+
 namespace pre {
 
     class PrimaryCtxt : public Ctxt {
@@ -13,12 +21,14 @@ namespace pre {
         CryptoPP::Integer const _D;
         CryptoPP::Integer const _c;
         CryptoPP::Integer const _s;
+        mutable std::atomic<bool> _validated;
 
         public:
             PrimaryCtxt(size_t ptxtBitSize, PublicKey const &pk,
                         CryptoPP::Integer const &A, CryptoPP::Integer const &B,
                         CryptoPP::Integer const &C, CryptoPP::Integer const &D,
                         CryptoPP::Integer const &c, CryptoPP::Integer const &s);
+            PrimaryCtxt(PrimaryCtxt const &other);
             
             CryptoPP::Integer const &A() const;
             CryptoPP::Integer const &B() const;
@@ -27,9 +37,22 @@ namespace pre {
             CryptoPP::Integer const &c() const;
             CryptoPP::Integer const &s() const;
 
+            // Checks the proof of the ciphertext, unless it already passed,
+            // which is remembered, copies included. Throws if it is invalid.
             void validate(PreScheme const &pre) const;
+            bool isValidated() const;
+
+            // Binary format, with the public key; see pre/integer_io.h. The
+            // validation is not saved, a ciphertext read is not validated.
+            void write(std::ostream &out) const;
+            static PrimaryCtxt read(std::istream &in);
         
         private:
+            // Only the document store, which only holds ciphertexts that
+            // were validated before being written, reads them as validated.
+            friend class muse::DocumentStore;
+            static PrimaryCtxt readValidated(std::istream &in);
+
             CryptoPP::Integer decryptImpl(PreScheme const &pre, PublicKey const &pk, SecretKey const &sk) const override;
     };
 }
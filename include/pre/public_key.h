@@ -1,6 +1,9 @@
 #ifndef PRE_PUBLIC_KEY_H
 #define PRE_PUBLIC_KEY_H
 
+#include <istream>
+#include <ostream>
+
 #include "cryptopp/integer.h"
 
 namespace pre {
@@ -20,6 +23,9 @@ namespace pre {
             CryptoPP::Integer const &g0() const;
             CryptoPP::Integer const &g1() const;
             CryptoPP::Integer const &g2() const;
+
+            void write(std::ostream &out) const;
+            static PublicKey read(std::istream &in);
     };
 }
 
@@ -1,6 +1,9 @@
 #ifndef PRE_REENCRYPTION_KEY_H
 #define PRE_REENCRYPTION_KEY_H
 
+#include <istream>
+#include <ostream>
+
 #include "cryptopp/integer.h"
 
 namespace pre {
@@ -18,6 +21,9 @@ namespace pre {
             CryptoPP::Integer const &B() const;
             CryptoPP::Integer const &C() const;
             CryptoPP::Integer const &R() const;
+
+            void write(std::ostream &out) const;
+            static ReencryptionKey read(std::istream &in);
     };
 }
 
@@ -5,6 +5,7 @@
 #include "cryptopp/aes.h"
 #include "cryptopp/modes.h"
 #include "cryptopp/filters.h"
+#include "helib/binio.h"
 #include "he_aes_cmac/public_key.h"
 
 namespace HeAesCmac {
@@ -29,10 +30,14 @@ namespace HeAesCmac {
         std::vector<helib::Ctxt> aesKeyCtxt;
         helib::Ctxt key1Ctxt(hePk.pk());
         helib::Ctxt key2Ctxt(hePk.pk());
+        helib::Ctxt packedKey1Ctxt(hePk.pk());
+        helib::Ctxt packedKey2Ctxt(hePk.pk());
         hePk.encryptAesKey(aesKey, aesKeyCtxt);
         hePk.encryptBlock(key1, key1Ctxt);
         hePk.encryptBlock(key2, key2Ctxt);
-        return CmacKeysCtxt(aesKeyCtxt, key1Ctxt, key2Ctxt);
+        hePk.encryptReplicatedBlock(key1, packedKey1Ctxt);
+        hePk.encryptReplicatedBlock(key2, packedKey2Ctxt);
+        return CmacKeysCtxt(aesKeyCtxt, key1Ctxt, key2Ctxt, packedKey1Ctxt, packedKey2Ctxt);
     }
 
     void CmacKeysCtxt::genSubKeys(std::vector<CryptoPP::byte> const &aesKey,
@@ -69,11 +74,26 @@ namespace HeAesCmac {
         }
     }
 
+    CmacKeysCtxt CmacKeysCtxt::read(std::istream &in, PublicKey const &hePk) {
+        std::vector<helib::Ctxt> aesKeyCtxt(helib::read_raw_int(in), helib::Ctxt(hePk.pk()));
+        for (auto &ctxt : aesKeyCtxt) {
+            ctxt.read(in);
+        }
+        std::vector<helib::Ctxt> keys(4, helib::Ctxt(hePk.pk()));
+        for (auto &ctxt : keys) {
+            ctxt.read(in);
+        }
+        return CmacKeysCtxt(aesKeyCtxt, keys[0], keys[1], keys[2], keys[3]);
+    }
+
     CmacKeysCtxt::CmacKeysCtxt(std::vector<helib::Ctxt> const &aesKey,
-                               helib::Ctxt const &key1, helib::Ctxt const &key2):
+                               helib::Ctxt const &key1, helib::Ctxt const &key2,
+                               helib::Ctxt const &packedKey1, helib::Ctxt const &packedKey2):
         _aesKey(aesKey),
         _key1(key1),
-        _key2(key2)
+        _key2(key2),
+        _packedKey1(packedKey1),
+        _packedKey2(packedKey2)
     {}
 
     std::vector<helib::Ctxt> const &CmacKeysCtxt::aesKey() const {
@@ -88,6 +108,24 @@ namespace HeAesCmac {
         return _key2;
     }
 
+    helib::Ctxt const &CmacKeysCtxt::packedKey1() const {
+        return _packedKey1;
+    }
+
+    helib::Ctxt const &CmacKeysCtxt::packedKey2() const {
+        return _packedKey2;
+    }
+
+    void CmacKeysCtxt::write(std::ostream &out) const {
+        helib::write_raw_int(out, _aesKey.size());
+        for (auto const &ctxt : _aesKey) {
+            ctxt.write(out);
+        }
+        for (auto const *ctxt : {&_key1, &_key2, &_packedKey1, &_packedKey2}) {
+            ctxt->write(out);
+        }
+    }
+
     void CmacKeysCtxt::leftshift(std::vector<CryptoPP::byte> &data) {
         CryptoPP::byte overflow = 0;
         for (auto it = std::begin(data); it != std::end(data); ++it) {
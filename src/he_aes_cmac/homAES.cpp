@@ -8,6 +8,10 @@ namespace std {} using namespace std;
 namespace NTL {} using namespace NTL;
 namespace helib {} using namespace helib;
 #include <cstring>
+#include <map>
+#include <mutex>
+#include <NTL/BasicThreadPool.h>
+#include "helib/keySwitching.h"
 #include "he_aes_cmac/homAES.h"
 
 #ifdef DEBUG_PRINTOUT
@@ -69,23 +73,26 @@ inline void buildAffineDec(vector<PolyType>& binMat,
 //   implementation would use the Hypercube class for slot index arithmetic.
 
 
+// The MixColumns/InvMixColumns matrices, and the identity for the rounds
+// that only apply RowShift
+static const uint8_t encMixCol[4][4] = {
+  { 2, 3, 1, 1 }, { 1, 2, 3, 1 }, { 1, 1, 2, 3 }, { 3, 1, 1, 2 } };
+static const uint8_t decMixCol[4][4] = {
+  { 0xE, 0xB, 0xD, 0x9 }, { 0x9, 0xE, 0xB, 0xD },
+  { 0xD, 0x9, 0xE, 0xB }, { 0xB, 0xD, 0x9, 0xE } };
+static const uint8_t noMixCol[4][4] = {
+  { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+
 // Compute the constants for the shoftRow/mixCol transformations
-static void buildLinEnc(vector<PolyType>& encLinTran,
-			const EncryptedArrayDerived<PA_GF2>& ea2);
-static void buildLinDec(vector<PolyType>& decLinTran,
-			const EncryptedArrayDerived<PA_GF2>& ea2);
+static std::shared_ptr<const MatMul1DExec>
+buildLinTran(const EncryptedArray& ea, const uint8_t mixCol[4][4], bool inverse);
 
 // Apply the shoftRow/mixCol transformations
-static void encRowColTran(Ctxt& eData, const vector<PolyType>& encLinTran,
-			  const EncryptedArrayDerived<PA_GF2>& ea2);
-static void encRowShift(Ctxt& c, const vector<PolyType>& encLinTran,
-			const EncryptedArrayDerived<PA_GF2>& ea2);
-static void decRowColTran(Ctxt& eData, const vector<PolyType>& decLinTran,
-			  const EncryptedArrayDerived<PA_GF2>& ea2);
-static void decRowShift(Ctxt& c, const vector<PolyType>& decLinTran,
-			const EncryptedArrayDerived<PA_GF2>& ea2);
+static void applyLinTran(Ctxt& c, const MatMul1DExec& tran);
 
-static void invert(vector<Ctxt>& data); // Z -> Z^{-1} in GF(2^8)
+// Apply the GF2-linear part of the affine transformation
+static void applyAffine(Ctxt& c, const vector<PolyType>& binMat,
+			const EncryptedArrayDerived<PA_GF2>& ea2);
 
 // Pack the ciphertexts in c in as few "fully packed" cipehrtext as possible.
 static void packCtxt(vector<Ctxt>& to, const vector<Ctxt>& from,
@@ -99,30 +106,171 @@ static void unackCtxt(vector<Ctxt>& to, const vector<Ctxt>& from,
 
 static long findBaseLevel(const Ctxt& c);
 
+// Set out = c after the Frobenius map X -> X^{2^j}. The maps of one
+// ciphertext only read it, so they can be computed concurrently.
+static void frobeniusOf(Ctxt& out, const Ctxt& c, long j)
+{
+  out = c;
+  out.frobeniusAutomorph(j);
+}
+
 // Implementation of the class HomAES
 
 static const uint8_t aesPolyBytes[] = { 0x1B, 0x1 }; // X^8+X^4+X^3+X+1
 const GF2X HomAES::aesPoly = GF2XFromBytes(aesPolyBytes, 2);
 
-HomAES::HomAES(const Context& context): ea2(context,aesPoly,context.alMod)
+// The constants of every live context. Entries are weak, so the constants
+// are released with the last HomAES object using them.
+static std::mutex tablesMutex;
+static std::map<const Context*, std::weak_ptr<const HomAESTables>> tablesRegistry;
+
+// Get the shared constants for the context of ea2, building them if needed
+static std::shared_ptr<const HomAESTables>
+getSharedTables(const EncryptedArrayDerived<PA_GF2>& ea2)
+{
+  std::lock_guard<std::mutex> lock(tablesMutex);
+  std::weak_ptr<const HomAESTables>& entry = tablesRegistry[&ea2.getContext()];
+  std::shared_ptr<const HomAESTables> tables = entry.lock();
+  if (!tables) {
+    tables = std::make_shared<const HomAESTables>(ea2);
+    entry = tables;
+
+    // Drop the entries of contexts that are gone
+    for (auto it = tablesRegistry.begin(); it != tablesRegistry.end(); )
+      if (it->second.expired()) it = tablesRegistry.erase(it);
+      else ++it;
+  }
+  return tables;
+}
+
+// Replace the shared constants for the context of ea2
+static void setSharedTables(const EncryptedArrayDerived<PA_GF2>& ea2,
+			    const std::shared_ptr<const HomAESTables>& tables)
+{
+  std::lock_guard<std::mutex> lock(tablesMutex);
+  tablesRegistry[&ea2.getContext()] = tables;
+}
+
+HomAESTables::HomAESTables(const EncryptedArrayDerived<PA_GF2>& ea2):
 #ifndef USE_ZZX_POLY // initialize DoubleCRT using the context
-, affVec(context,context.allPrimes())
+  affVec(ea2.getContext(),ea2.getContext().allPrimes()),
 #endif
+  aesEa(std::make_shared<const EncryptedArray>(ea2.getContext(),
+					       conv<ZZX>(ea2.getG())))
 {
-  // Sanity-check: we need the first dimension to be divisible by 16.
-  //OLD: assert( context.zMStar.OrderOf(0) % 16 == 0 );
-  helib::assertEq(context.zMStar.OrderOf(0) % 16, 0l, "The first dimension need to be divisible by 16");
-
   // Compute the GF2-affine transformation constants
   buildAffineEnc(encAffMat, affVec, ea2);
   buildAffineDec(decAffMat, ea2);
 
   // Compute the rowShift/colMix constants
-  buildLinEnc(encLinTran, ea2);
-  buildLinDec(decLinTran, ea2);
+  encRowCol = buildLinTran(*aesEa, encMixCol, false);
+  encRowShift = buildLinTran(*aesEa, noMixCol, false);
+  decRowCol = buildLinTran(*aesEa, decMixCol, true);
+  decRowShift = buildLinTran(*aesEa, noMixCol, true);
+
+  if (ea2.getContext().isBootstrappable())
+    buildPackingConstants(ea2.getContext());
+}
+
+#ifdef USE_ZZX_POLY
+static long polyBytes(const ZZX& p)
+{
+  long n = 0;
+  for (long i=0; i<=deg(p); i++) n += NumBytes(coeff(p,i)) + sizeof(ZZ);
+  return n;
+}
+#else
+static long polyBytes(const DoubleCRT& p)
+{
+  const Context& context = p.getContext();
+  return card(p.getIndexSet()) * context.zMStar.getPhiM() * sizeof(long);
+}
+#endif
+
+// The constants of a MatMul1DExec are opaque, but they are DoubleCRTs over
+// all the primes once upgraded
+static long execBytes(const MatMul1DExec& exec)
+{
+  const Context& context = exec.getEA().getContext();
+  long perConstant =
+    card(context.allPrimes()) * context.zMStar.getPhiM() * sizeof(long);
+  long n = 0;
+  for (const ConstMultiplierCache* cache : { &exec.cache, &exec.cache1 })
+    for (const auto& multiplier : cache->multiplier)
+      if (multiplier) n += perConstant;
+  return n;
+}
 
-  if (context.isBootstrappable())
-    setPackingConstants();
+long HomAESTables::bytes() const
+{
+  long n = polyBytes(affVec);
+  for (const PolyType& p : encAffMat) n += polyBytes(p);
+  for (const PolyType& p : decAffMat) n += polyBytes(p);
+  for (const MatMul1DExec* tran : { encRowCol.get(), encRowShift.get(),
+				    decRowCol.get(), decRowShift.get() })
+    n += execBytes(*tran);
+  n += NumBytes(XinSlots);
+  for (long i=0; i<unpacking.NumRows(); i++)
+    for (long j=0; j<unpacking.NumCols(); j++)
+      n += NumBytes(unpacking[i][j]);
+  return n;
+}
+
+HomAES::HomAES(const Context& context): ea2(context,aesPoly,context.alMod),
+  encoder(std::make_shared<AESEncoder>(ea2)), nThreads(1), sbox(std::make_shared<FrobeniusChainSBox>())
+{
+  // Sanity-check: we need the first dimension to be divisible by 16.
+  //OLD: assert( context.zMStar.OrderOf(0) % 16 == 0 );
+  helib::assertEq(context.zMStar.OrderOf(0) % 16, 0l, "The first dimension need to be divisible by 16");
+
+  // Get the (possibly already computed) GF2-affine and rowShift/colMix
+  // constants, and the packing constants if context is bootstrappable
+  tables = getSharedTables(ea2);
+}
+
+// Set the number of threads used by the AES computations
+void HomAES::setThreads(long n)
+{
+  helib::assertTrue<helib::InvalidArgument>(n >= 1,
+                                            "Number of threads must be positive");
+  nThreads = n;
+}
+
+// Size the thread pool of the calling thread to nThreads. NTL keeps one pool
+// per thread, so this does not affect other threads using the library.
+void HomAES::useThreads() const
+{
+  if (AvailableThreads() != nThreads)
+    SetNumThreads(nThreads);
+}
+
+// Set the S-box engine used by ByteSub
+void HomAES::setSBox(std::shared_ptr<const SBoxEngine> engine)
+{
+  helib::assertNotNull<helib::InvalidArgument>(engine, "S-box engine is null");
+  sbox = engine;
+}
+
+// The automorphisms of applyAffine, of the S-box and of applyLinTran. The
+// rotations of MatMul1DExec along the first dimension are all of them for
+// a small dimension, else its baby steps and giant steps, as generated by
+// addSome1DMatrices.
+void HomAES::automorphisms(std::set<long>& vals) const
+{
+  const PAlgebra& zMStar = ea2.getContext().zMStar;
+
+  for (const vector<PolyType>* binMat : { &tables->encAffMat, &tables->decAffMat })
+    for (long j=1; j<lsize(*binMat); j++)
+      vals.insert(zMStar.frobeniusPow(j));
+  for (long j : sbox->frobeniusPowers())
+    vals.insert(zMStar.frobeniusPow(j));
+
+  long D = zMStar.OrderOf(0);
+  long g = (D <= HELIB_KEYSWITCH_THRESH) ? D : KSGiantStepSize(D);
+  for (long k=1; k<g; k++)
+    rotationAutomorphisms(vals, zMStar, 0, k);
+  for (long k=g; k<D; k+=g)
+    rotationAutomorphisms(vals, zMStar, 0, k);
 }
 
 // run the AES key-expansion and then encrypt the expanded key.
@@ -162,11 +310,23 @@ void HomAES::encryptAESkey(vector<Ctxt>& eKey, vector<uint8_t>& aesKey,
 }
 
 
-// Compute the packing/unpacking constants
+// Compute the packing/unpacking constants. The shared constants are
+// immutable, so this replaces them by a copy that includes the packing
+// constants.
 void HomAES::setPackingConstants()
 {
-  // Get the context and the ea for "fully packed" polynomials
-  const Context& context = ea2.getContext();
+  if (tables->unpacking.NumRows() > 0) return; // already computed
+
+  std::shared_ptr<HomAESTables> withPacking =
+    std::make_shared<HomAESTables>(*tables);
+  withPacking->buildPackingConstants(ea2.getContext());
+  tables = withPacking;
+  setSharedTables(ea2, tables);
+}
+
+void HomAESTables::buildPackingConstants(const Context& context)
+{
+  // Get the ea for "fully packed" polynomials
   const EncryptedArrayDerived<PA_GF2>& ea = context.ea->getDerived(PA_GF2());
 
   // Compute the packing constants, with X in all the slots
@@ -222,10 +382,13 @@ void HomAES::homAESenc(vector<Ctxt>& eData, const vector<Ctxt>& aesKey) const
   for (long j=0; j<(long)eData.size(); j++)
     eData[j] += aesKey[0];  // initial key addition
 
+  useThreads();
   for (long i=1; i<(long)aesKey.size(); i++) { // apply the AES rounds
+    HELIB_NTIMER_START(homAESencRound);
 
     // ByteSub
-    if (findBaseLevel(eData[0]) < 4) batchRecrypt(eData);
+    HELIB_NTIMER_START(homAESencByteSub);
+    if (findBaseLevel(eData[0]) < sbox->depth()+1) batchRecrypt(eData);
     invert(eData);     // apply Z -> Z^{-1} to all elements of eData
 #ifdef DEBUG_PRINTOUT
     CheckCtxt(eData[0], "+ After invert");
@@ -233,10 +396,13 @@ void HomAES::homAESenc(vector<Ctxt>& eData, const vector<Ctxt>& aesKey) const
     //    decryptAndPrint(cerr, eData[0], *dbgKey, *dbgEa);
 #endif
     if (findBaseLevel(eData[0]) < 2) batchRecrypt(eData);
-    for (long j=0; j<(long)eData.size(); j++) { // GF2 affine transformation
-      applyLinPolyLL(eData[j], encAffMat, ea2.getDegree());
-      eData[j].addConstant(affVec);
+    NTL_EXEC_RANGE(long(eData.size()), first, last)
+    for (long j=first; j<last; j++) { // GF2 affine transformation
+      applyAffine(eData[j], tables->encAffMat, ea2);
+      eData[j].addConstant(tables->affVec);
     }
+    NTL_EXEC_RANGE_END
+    HELIB_NTIMER_STOP(homAESencByteSub);
 #ifdef DEBUG_PRINTOUT
     CheckCtxt(eData[0], "+ After affine");
     //    cerr << " + After affine ";
@@ -244,15 +410,16 @@ void HomAES::homAESenc(vector<Ctxt>& eData, const vector<Ctxt>& aesKey) const
 #endif
 
     // Apply RowShift/ColMix to each ciphertext
+    HELIB_NTIMER_START(homAESencLinear);
     if (findBaseLevel(eData[0]) < 2) batchRecrypt(eData);
-    if (i<(long)aesKey.size()-1) {
-      for (long j=0; j<(long)eData.size(); j++)
-	encRowColTran(eData[j], encLinTran, ea2);
-    }
-    else { // For the last round apply only RowShift, not ColMix
-      for (long j=0; j<(long)eData.size(); j++)
-	encRowShift(eData[j], encLinTran, ea2);
-    }
+    // For the last round apply only RowShift, not ColMix
+    const MatMul1DExec& encTran =
+      (i<(long)aesKey.size()-1)? *tables->encRowCol : *tables->encRowShift;
+    NTL_EXEC_RANGE(long(eData.size()), first, last)
+    for (long j=first; j<last; j++)
+      applyLinTran(eData[j], encTran);
+    NTL_EXEC_RANGE_END
+    HELIB_NTIMER_STOP(homAESencLinear);
 #ifdef DEBUG_PRINTOUT
     CheckCtxt(eData[0], "+ After rowShift/colMix");
     //    cerr << " + After rowShift/colMix ";
@@ -261,6 +428,7 @@ void HomAES::homAESenc(vector<Ctxt>& eData, const vector<Ctxt>& aesKey) const
 
     // Key addition
     for (long j=0; j<(long)eData.size(); j++) eData[j] += aesKey[i];
+    HELIB_NTIMER_STOP(homAESencRound);
   }
 }
 
@@ -297,20 +465,24 @@ void HomAES::homAESdec(vector<Ctxt>& eData, const vector<Ctxt>& aesKey) const
   if (1>(long)eData.size() || 1>(long)aesKey.size()) return; // no data/key
   //  long lvlBits = eData[0].getContext().bitsPerLevel;
 
+  useThreads();
   for (long i=aesKey.size()-1; i>0; i--) { // apply the AES rounds
+    HELIB_NTIMER_START(homAESdecRound);
     // Key addition
     for (long j=0; j<(long)eData.size(); j++) eData[j] -= aesKey[i];
 
     // Apply RowShift/ColMix to each ciphertext
+    HELIB_NTIMER_START(homAESdecLinear);
     if (findBaseLevel(eData[0]) < 2) batchRecrypt(eData);
     //    if (eData[0].log_of_ratio() > (-lvlBits)) batchRecrypt(eData);
-    if (i<(long)aesKey.size()-1)
-      for (long j=0; j<(long)eData.size(); j++)
-	decRowColTran(eData[j], decLinTran, ea2);
-
-    else // For the first round apply only RowShift, not ColMix
-      for (long j=0; j<(long)eData.size(); j++)
-	decRowShift(eData[j], decLinTran, ea2);
+    // For the first round apply only RowShift, not ColMix
+    const MatMul1DExec& decTran =
+      (i<(long)aesKey.size()-1)? *tables->decRowCol : *tables->decRowShift;
+    NTL_EXEC_RANGE(long(eData.size()), first, last)
+    for (long j=first; j<last; j++)
+      applyLinTran(eData[j], decTran);
+    NTL_EXEC_RANGE_END
+    HELIB_NTIMER_STOP(homAESdecLinear);
 #ifdef DEBUG_PRINTOUT
     CheckCtxt(eData[0], "+ After rowShift/colMix");
     //    cerr << " + After rowShift/colMix ";
@@ -318,23 +490,28 @@ void HomAES::homAESdec(vector<Ctxt>& eData, const vector<Ctxt>& aesKey) const
 #endif
 
     // ByteSub
+    HELIB_NTIMER_START(homAESdecByteSub);
     if (findBaseLevel(eData[0]) < 2) batchRecrypt(eData);
-    for (long j=0; j<(long)eData.size(); j++) { // GF2 affine transformation
-      eData[j].addConstant(affVec);
-      applyLinPolyLL(eData[j], decAffMat, ea2.getDegree());
+    NTL_EXEC_RANGE(long(eData.size()), first, last)
+    for (long j=first; j<last; j++) { // GF2 affine transformation
+      eData[j].addConstant(tables->affVec);
+      applyAffine(eData[j], tables->decAffMat, ea2);
     }
+    NTL_EXEC_RANGE_END
 #ifdef DEBUG_PRINTOUT
     CheckCtxt(eData[0], "+ After affine");
     //    cerr << " + After affine ";
     //    decryptAndPrint(cerr, eData[0], *dbgKey, *dbgEa);
 #endif
-    if (findBaseLevel(eData[0]) < 4) batchRecrypt(eData);
+    if (findBaseLevel(eData[0]) < sbox->depth()+1) batchRecrypt(eData);
      invert(eData); // apply Z -> Z^{-1} to all elements of eData
+    HELIB_NTIMER_STOP(homAESdecByteSub);
 #ifdef DEBUG_PRINTOUT
     CheckCtxt(eData[0], "+ After invert");
     //    cerr << " + After invert ";
     //    decryptAndPrint(cerr, eData[0], *dbgKey, *dbgEa);
 #endif
+    HELIB_NTIMER_STOP(homAESdecRound);
   }
 
   for (long j=0; j<(long)eData.size(); j++)
@@ -369,13 +546,14 @@ void HomAES::batchRecrypt(vector<Ctxt>& data) const
   PubKey& pk = (PubKey&) data[0].getPubKey();
   if (!pk.isBootstrappable()) return;
 
-  if (data.size()>1 && unpacking.NumRows()==0) // lazy initialization
-    return; // setPackingConstants();
+  // Without the packing constants (e.g. if the context was made bootstrappable
+  // after this object was built) we recrypt the ciphertexts one by one
+  bool canPack = (tables->unpacking.NumRows() > 0);
 
   vector<Ctxt>* pData = &data;
   vector<Ctxt> fullyPacked; // empty at first
-  if (data.size()>1) {      // pack to save on recryption operations
-    packCtxt(fullyPacked, data, XinSlots);
+  if (data.size()>1 && canPack) { // pack to save on recryption operations
+    packCtxt(fullyPacked, data, tables->XinSlots);
     pData = &fullyPacked;
   }
 
@@ -391,13 +569,15 @@ void HomAES::batchRecrypt(vector<Ctxt>& data) const
 
   // recrypt each ciphertext in the vector
   HELIB_NTIMER_START(recryption);
-  for (long i=0; i<(long)pData->size(); i++)
+  NTL_EXEC_RANGE(long(pData->size()), first, last)
+  for (long i=first; i<last; i++)
     pk.reCrypt((*pData)[i]);
+  NTL_EXEC_RANGE_END
   HELIB_NTIMER_STOP(recryption);
 
   // unpack back to the original vector, if needed
   if (fullyPacked.size()>0) {
-    unackCtxt(data, fullyPacked, unpacking);
+    unackCtxt(data, fullyPacked, tables->unpacking);
   }
 
 #ifdef DEBUG_PRINTOUT
@@ -468,258 +648,71 @@ static void buildAffine(vector<PolyType>& binMat, PolyType* binVec,
 }
 
 
-// Compute the constants for the shoftRow/mixCol transformations
-static void buildLinEnc(vector<PolyType>& encLinTran,
-			const EncryptedArrayDerived<PA_GF2>& ea2)
-{
-  // The constants only have nonzero entires in their slots corresponding
-  // to bytes 0,4,8,12 of each blocks. Since the blocks are interleaved, it
-  // means that the non-zero slots are nBlocks*{0,4,8,12}+{0,1,...,nBlocks-1}.
-  // The three constants have in these slots 1, X, and X+1, corresponding
-  // to hex values 1, 2, 3 respectively.
-  uint8_t hexVals[3] = { 1, 2, 3 };
-
-  vector<uint8_t> bytes(ea2.size());
-  long blocksPerCtxt = ea2.size() / 16;
-  Vec<ZZX> tmp;
-#ifdef USE_ZZX_POLY
-  encLinTran.resize(6);
-#else
-  encLinTran.resize(6,DoubleCRT(ea2.getContext(),ea2.getContext().allPrimes()));
-#endif
-  for (long i=0; i<3; i++) { // constants for the RowShift/ColMix trans
-    for (long j=0; j<blocksPerCtxt; j++) {
-      uint8_t* bptr = &bytes[16*j];
-      bptr[0] = bptr[4] = bptr[8] = bptr[12] = hexVals[i];
-    }
-    encode4AES(tmp, bytes, ea2);
-    encLinTran[i] = tmp[0];
-  }
-  for (long i=0; i<3; i++) { // masks for only RowShift (last round)
-    memset(bytes.data(), 0, bytes.size());
-    for (long j=0; j<blocksPerCtxt; j++) {
-      uint8_t* bptr = &bytes[16*j +i+1];
-      bptr[0] = bptr[4] = bptr[8] = bptr[12] = 1;
+// The shoftRow/mixCol transformations, as a matrix along the first
+// dimension. With the bytes of a block in column order (byte k=r+4c is in
+// row r, column c), output byte k is the sum over r' of mixCol[r][r'] times
+// the input byte r'+4c' in the column c' that RowShift moves into column c.
+// Rotating by OrderOf(0)/16 along the first dimension moves each byte of a
+// block to the next one, so byte k of a block has the coordinate k*R+t
+// along it, where R=OrderOf(0)/16 and t<R only depends on the block.
+class AESLinMatrix : public MatMul1D_derived<PA_GF2> {
+  const EncryptedArray& ea;
+  uint8_t coeff[16][16]; // coeff[k][k1] = the coefficient of byte k1 in byte k
+
+public:
+  PA_INJECT(PA_GF2)
+
+  AESLinMatrix(const EncryptedArray& _ea, const uint8_t mixCol[4][4],
+	       bool inverse): ea(_ea)
+  {
+    memset(coeff, 0, sizeof(coeff));
+    for (long k=0; k<16; k++) {
+      long r = k % 4, c = k / 4;
+      for (long r1=0; r1<4; r1++) {
+	// Encryption does RowShift then ColMix, so the byte comes from
+	// column c+r1. Decryption does InvColMix then InvRowShift, so it
+	// comes from column c-r.
+	long c1 = inverse ? (c - r + 4) % 4 : (c + r1) % 4;
+	coeff[k][r1 + 4*c1] = mixCol[r][r1];
+      }
     }
-    encode4AES(tmp, bytes, ea2);
-    encLinTran[i+3] = tmp[0];
   }
-}
-
-// Apply the shoftRow/mixCol transformations
-static void encRowColTran(Ctxt& c, const vector<PolyType>& encLinTran,
-			  const EncryptedArrayDerived<PA_GF2>& ea2)
-{
-  // The basic rotation amount along the 1st dimension
-  long rotAmount = ea2.getContext().zMStar.OrderOf(0) / 16;
-
-  c.cleanUp();
-  Ctxt c1(c), c6(c), c11(c);
-  ea2.rotate1D(c1, 0, rotAmount);   // rotation + re-linearization
-  ea2.rotate1D(c6, 0, 6*rotAmount); // rotation + re-linearization
-  ea2.rotate1D(c11,0,11*rotAmount); // rotation + re-linearization
-  c1.cleanUp();  c6.cleanUp();  c1.cleanUp();
-
-  const PolyType& p1 = encLinTran[0]; // 1
-  const PolyType& p2 = encLinTran[1]; // X
-  const PolyType& p3 = encLinTran[2]; // X+1
-
-  /* return ( c*p2 + c1*p1 + c6*p1 + c11*p3
-   *         + (c*p1 + c1*p1 + c6*p3 + c11*p2)>>1
-   *         + (c*p1 + c1*p3 + c6*p2 + c11*p1)>>2
-   *         + (c*p3 + c1*p2 + c6*p1 + c11*p1)>>3 )
-   */
-
-  // Compute the top row of the AES matrix
-  Ctxt sum(c), tmpA(c1), tmpB(c11);
-  tmpA += c6;
-  sum.multByConstant(p2);
-  tmpA.multByConstant(p1);
-  tmpB.multByConstant(p3);
-  sum += tmpA; sum += tmpB;
-
-  // Compute the 2nd row of the AES matrix
-  tmpA = c; tmpA += c1; tmpA.multByConstant(p1);
-  tmpB = c6;            tmpB.multByConstant(p3);
-  Ctxt tmpC(c11);       tmpC.multByConstant(p2);
-  tmpA += tmpB; tmpA += tmpC;
-  ea2.rotate1D(tmpA, 0, rotAmount); // rotation + re-linearization
-  sum += tmpA;
-
-  // Compute the 3rd row of the AES matrix
-  tmpA = c;  tmpA += c11;  tmpA.multByConstant(p1);
-  tmpB = c1;               tmpB.multByConstant(p3);
-  tmpC = c6;               tmpC.multByConstant(p2);
-  tmpA += tmpB; tmpA += tmpC;
-  ea2.rotate1D(tmpA, 0, 2*rotAmount); // rotation + re-linearization
-  sum += tmpA;
-
-  // Compute the bottom row of the AES matrix
-  c.multByConstant(p3);
-  c1.multByConstant(p2);
-  c6 += c11; c6.multByConstant(p1);
-  c += c1; c += c6;
-  ea2.rotate1D(c, 0, 3*rotAmount); // rotation + re-linearization
-  c += sum;
-
-  c.cleanUp();
-}
-
-static void encRowShift(Ctxt& c, const vector<PolyType>& encLinTran,
-			const EncryptedArrayDerived<PA_GF2>& ea2)
-{
-  // The basic rotation amount along the 1st dimension
-  long rotAmount = ea2.getContext().zMStar.OrderOf(0) / 16;
 
-  c.cleanUp();
-  Ctxt c4(c), c8(c), c12(c);
-  ea2.rotate1D(c4, 0, 4*rotAmount);
-  ea2.rotate1D(c8, 0, 8*rotAmount);
-  ea2.rotate1D(c12,0, 12*rotAmount);
-  c4.cleanUp();  c8.cleanUp();  c12.cleanUp();
-
-  const PolyType& p0 = encLinTran[0]; // 1
-  const PolyType& p4 = encLinTran[3]; // 1>>4
-  const PolyType& p8 = encLinTran[4]; // 1>>8
-  const PolyType& p12 = encLinTran[5]; // 1>>12
-
-  // return c*p0 + c4*p12 + c8*p8 + c12*p4
-
-  c.multByConstant(p0);
-  c4.multByConstant(p12); c += c4;
-  c8.multByConstant(p8);  c += c8;
-  c12.multByConstant(p4); c += c12;
-}
-
-static void buildLinDec(vector<PolyType>& decLinTran,
-			const EncryptedArrayDerived<PA_GF2>& ea2)
-{
-  // The constants only have nonzero entires in their slots corresponding
-  // to bytes 0,4,8,12 of each blocks. Since the blocks are interleaved, it
-  // means that the non-zero slots are nBlocks*{0,4,8,12}+{0,1,...,nBlocks-1}.
-  // The three constants have in these slots the polynomials corresponding
-  // to hex values ox9, 0xB, 0xD, and 0xE respectively.
-
-  uint8_t hexVals[4] = { 0x9, 0xB, 0xD, 0xE };
-
-  vector<uint8_t> bytes(ea2.size());
-  memset(bytes.data(), 0, bytes.size());
-  long blocksPerCtxt = ea2.size() / 16;
-
-  Vec<ZZX> tmp;
-#ifdef USE_ZZX_POLY
-  decLinTran.resize(8);
-#else
-  decLinTran.resize(8,DoubleCRT(ea2.getContext(),ea2.getContext().allPrimes()));
-#endif
-  for (long i=0; i<4; i++) { // constants for the RowShift/ColMix trans
-    for (long j=0; j<blocksPerCtxt; j++) {
-      uint8_t* bptr = &bytes[16*j];
-      bptr[0] = bptr[4] = bptr[8] = bptr[12] = hexVals[i];
-    }
-    encode4AES(tmp, bytes, ea2);
-    decLinTran[i] = tmp[0];
+  const EncryptedArray& getEA() const override { return ea; }
+  long getDim() const override { return 0; }
+  bool multipleTransforms() const override { return false; }
+
+  // Entry (i,j) is the coefficient of input coordinate i in output
+  // coordinate j; returns true for a zero entry
+  bool get(RX& out, long i, long j, long /*k*/) const override
+  {
+    long R = ea.sizeOfDimension(0) / 16;
+    if (i % R != j % R) return true; // different blocks
+    uint8_t c = coeff[j / R][i / R];
+    if (c == 0) return true;
+    GF2XFromBytes(out, &c, 1);
+    return false;
   }
-  for (long i=0; i<4; i++) { // masks for only RowShift (first round)
-    memset(bytes.data(), 0, bytes.size());
-    for (long j=0; j<blocksPerCtxt; j++) {
-      uint8_t* bptr = &bytes[16*j +i];
-      bptr[0] = bptr[4] = bptr[8] = bptr[12] = 1;
-    }
-    encode4AES(tmp, bytes, ea2);
-    decLinTran[i+4] = tmp[0];
-  }
-}
-
+};
 
-static void decRowColTran(Ctxt& c, const vector<PolyType>& decLinTran,
-			  const EncryptedArrayDerived<PA_GF2>& ea2)
+// HElib keeps the matrix as its diagonals, upgraded to DoubleCRT once here
+static std::shared_ptr<const MatMul1DExec>
+buildLinTran(const EncryptedArray& ea, const uint8_t mixCol[4][4], bool inverse)
 {
-  // The basic rotation amount along the 1st dimension
-  long rotAmount = ea2.getContext().zMStar.OrderOf(0) / 16;
-
-  c.cleanUp();
-  Ctxt cf(c), ce(c), cd(c);
-  ea2.rotate1D(cf, 0, 15*rotAmount); // rotation + re-linearization
-  ea2.rotate1D(ce, 0, 14*rotAmount); // rotation + re-linearization
-  ea2.rotate1D(cd, 0, 13*rotAmount); // rotation + re-linearization
-  cf.cleanUp();  ce.cleanUp();  cd.cleanUp();
-
-  const PolyType& p9 = decLinTran[0]; // poly represented by 0x9
-  const PolyType& pB = decLinTran[1]; // poly represented by 0xE
-  const PolyType& pD = decLinTran[2]; // poly represented by 0xD
-  const PolyType& pE = decLinTran[3]; // poly represented by 0xE
-
-  /* return ( c*pE + cf*pB + ce*pD + cd*p9
-   *         + (c*p9 + cf*pE + ce*pB + cd*pD)>>1
-   *         + (c*pD + cf*p9 + ce*pE + cd*pB)>>2
-   *         + (c*pB + cf*pD + ce*p9 + cd*pE)>>3 )
-   */
-
-  // Compute the top row of the AES matrix
-  Ctxt sum(c), tmpF(cf), tmpE(ce), tmpD(cd);
-  sum.multByConstant(pE);
-  tmpF.multByConstant(pB);
-  tmpE.multByConstant(pD);
-  tmpD.multByConstant(p9);
-  sum += tmpF; sum += tmpE; sum += tmpD;
-
-  // Compute the 2nd row of the AES matrix
-  Ctxt tmp(c); tmpF = cf; tmpE = ce; tmpD = cd; 
-  tmp.multByConstant(p9);
-  tmpF.multByConstant(pE);
-  tmpE.multByConstant(pB);
-  tmpD.multByConstant(pD);
-  tmp += tmpF; tmp += tmpE; tmp += tmpD;
-  ea2.rotate1D(tmp, 0, 5*rotAmount); // rotation + re-linearization
-  sum += tmp;
-
-  // Compute the 3rd row of the AES matrix
-  tmp = c; tmpF = cf; tmpE = ce; tmpD = cd; 
-  tmp.multByConstant(pD);
-  tmpF.multByConstant(p9);
-  tmpE.multByConstant(pE);
-  tmpD.multByConstant(pB);
-  tmp += tmpF; tmp += tmpE; tmp += tmpD;
-  ea2.rotate1D(tmp, 0, 10*rotAmount); // rotation + re-linearization
-  sum += tmp;
-
-  // Compute the bottom row of the AES matrix
-  c.multByConstant(pB);
-  cf.multByConstant(pD);
-  ce.multByConstant(p9);
-  cd.multByConstant(pE);
-  c += cf; c += ce; c += cd;
-  ea2.rotate1D(c, 0, 15*rotAmount); // rotation + re-linearization
-  c += sum;
-
-  c.cleanUp();
+  AESLinMatrix mat(ea, mixCol, inverse);
+  std::shared_ptr<MatMul1DExec> exec = std::make_shared<MatMul1DExec>(mat);
+  exec->upgrade();
+  return exec;
 }
 
-static void decRowShift(Ctxt& c, const vector<PolyType>& decLinTran,
-			const EncryptedArrayDerived<PA_GF2>& ea2)
+// Apply the shoftRow/mixCol transformations. MatMul1DExec decomposes the
+// ciphertext once for all its baby-step rotations (or for all the
+// rotations, along a small dimension), and only key-switches the giant
+// steps in full.
+static void applyLinTran(Ctxt& c, const MatMul1DExec& tran)
 {
-  // The basic rotation amount along the 1st dimension
-  long rotAmount = ea2.getContext().zMStar.OrderOf(0) / 16;
-
+  tran.mul(c);
   c.cleanUp();
-  Ctxt c4(c), c8(c), c12(c);
-  ea2.rotate1D(c4, 0, 4*rotAmount);
-  ea2.rotate1D(c8, 0, 8*rotAmount);
-  ea2.rotate1D(c12,0, 12*rotAmount);
-  c4.cleanUp();  c8.cleanUp();  c12.cleanUp();
-
-  const PolyType& p0 = decLinTran[4]; // 1
-  const PolyType& p4 = decLinTran[5]; // 1>>4
-  const PolyType& p8 = decLinTran[6]; // 1>>8
-  const PolyType& p12 = decLinTran[7]; // 1>>12
-
-  // return c*p0 + c4*p4 + c8*p8 + c12*p12
-
-  c.multByConstant(p0);
-  c4.multByConstant(p4); c += c4;
-  c8.multByConstant(p8);  c += c8;
-  c12.multByConstant(p12); c += c12;
 }
 
 // Encode AES plaintext/ciphertext bytes as native HE plaintext
@@ -780,20 +773,232 @@ void decode4AES(vector<uint8_t>& data, const Vec<ZZX>& encData,
   }
 }
 
-// the transformation X -> X^{-1} in GF(2^8)
-static void invert(vector<Ctxt>& data)
+AESEncoder::AESEncoder(const EncryptedArrayDerived<PA_GF2>& ea,
+		       long maxCachedSlots):
+  ea2(ea), maxSlots(maxCachedSlots), cache(ea.size()), nCached(0)
+{}
+
+// Encode X^b alone in the slot, and find 8 coefficients modulo the factor
+// of the slot that determine the byte (the slot holds GF(2^8) embedded in
+// a larger field, so the other coefficients are redundant)
+std::shared_ptr<const AESEncoder::SlotCode> AESEncoder::buildSlotCode(long slot) const
+{
+  auto code = std::make_shared<SlotCode>();
+  const GF2X& factor = ea2.getTab().getFactors()[slot];
+  long d = deg(factor);
+
+  code->bits.resize(8);
+  vector<GF2X> reps(8);
+  vector<GF2X> slots(ea2.size(), GF2X::zero());
+  for (long b=0; b<8; b++) {
+    ZZX tmp;
+    SetCoeff(slots[slot], b);
+    ea2.encode(tmp, slots);
+    clear(slots[slot]);
+    conv(code->bits[b], tmp);
+    rem(reps[b], code->bits[b], factor);
+  }
+
+  // Greedily pick the coefficients that increase the rank
+  mat_GF2 picked;
+  for (long t=0; t<d && code->pivots.size()<8; t++) {
+    mat_GF2 test(picked);
+    test.SetDims(picked.NumRows()+1, 8);
+    for (long b=0; b<8; b++)
+      test[picked.NumRows()][b] = coeff(reps[b], t);
+    mat_GF2 echelon(test);
+    if (gauss(echelon) == test.NumRows()) {
+      picked = test;
+      code->pivots.push_back(t);
+    }
+  }
+  code->decodable = (code->pivots.size() == 8);
+  if (code->decodable)
+    inv(code->fromPivots, picked);
+  return code;
+}
+
+bool AESEncoder::getSlotCodes(vector<std::shared_ptr<const SlotCode>>& codes,
+			      const vector<long>& slotIdx) const
+{
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  long missing = 0;
+  for (long s : slotIdx)
+    if (!cache[s]) missing++;
+  if (nCached + missing > maxSlots)
+    return false;
+
+  codes.resize(slotIdx.size());
+  for (long i=0; i<lsize(slotIdx); i++) {
+    long s = slotIdx[i];
+    if (!cache[s]) {
+      cache[s] = buildSlotCode(s);
+      nCached++;
+    }
+    codes[i] = cache[s];
+  }
+  return true;
+}
+
+void AESEncoder::encode(ZZX& poly, const vector<uint8_t>& data) const
+{
+  helib::assertTrue<helib::InvalidArgument>(lsize(data) <= ea2.size(),
+      "AESEncoder::encode: more bytes than slots");
+  long blocksPerCtxt = ea2.size() / 16;
+
+  // only the non-zero bytes contribute to the encoding
+  vector<long> byteIdx, slotIdx;
+  for (long i=0; i<lsize(data); i++)
+    if (data[i] != 0) {
+      byteIdx.push_back(i);
+      slotIdx.push_back(i/16 + (i%16)*blocksPerCtxt);
+    }
+
+  vector<std::shared_ptr<const SlotCode>> codes;
+  if (!getSlotCodes(codes, slotIdx)) {
+    Vec<ZZX> encData;
+    encode4AES(encData, data, ea2);
+    poly = encData[0];
+    return;
+  }
+
+  GF2X sum;
+  for (long i=0; i<lsize(byteIdx); i++) {
+    uint8_t byte = data[byteIdx[i]];
+    for (long b=0; b<8; b++)
+      if ((byte >> b) & 1)
+	add(sum, sum, codes[i]->bits[b]);
+  }
+  conv(poly, sum);
+}
+
+void AESEncoder::decode(vector<uint8_t>& data, const ZZX& poly, long nBytes) const
 {
-  for (long i=0; i<(long)data.size(); i++){ // compute X -> X^{254} on i'th ctxt
-    Ctxt tmp1(data[i]);           // tmp1   = data[i] = X
-    tmp1.frobeniusAutomorph(1);   // tmp1   = X^2   after Z -> Z^2
-    data[i].multiplyBy(tmp1);     // data[i]= X^3
-    Ctxt tmp2(data[i]);           // tmp2   = X^3
-    tmp2.frobeniusAutomorph(2);   // tmp2   = X^12  after Z -> Z^4
-    tmp1.multiplyBy(tmp2);        // tmp1   = X^14
-    data[i].multiplyBy(tmp2);     // data[i]= X^15
-    data[i].frobeniusAutomorph(4);// data[i]= X^240 after Z -> Z^16
-    data[i].multiplyBy(tmp1);     // data[i]= X^254
+  helib::assertTrue<helib::InvalidArgument>(nBytes >= 0 && nBytes <= ea2.size(),
+      "AESEncoder::decode: more bytes than slots");
+  long blocksPerCtxt = ea2.size() / 16;
+
+  vector<long> slotIdx(nBytes);
+  for (long i=0; i<nBytes; i++)
+    slotIdx[i] = i/16 + (i%16)*blocksPerCtxt;
+
+  vector<std::shared_ptr<const SlotCode>> codes;
+  bool fast = getSlotCodes(codes, slotIdx);
+  for (long i=0; fast && i<nBytes; i++)
+    fast = codes[i]->decodable;
+  if (!fast) {
+    Vec<ZZX> encData(INIT_SIZE, 1, poly);
+    data.resize(nBytes);
+    decode4AES(data, encData, ea2);
+    return;
+  }
+
+  GF2X ptxt, slot;
+  conv(ptxt, poly);
+  data.assign(nBytes, 0);
+  vec_GF2 coeffs(INIT_SIZE, 8), bits;
+  for (long i=0; i<nBytes; i++) {
+    rem(slot, ptxt, ea2.getTab().getFactors()[slotIdx[i]]);
+    for (long p=0; p<8; p++)
+      coeffs[p] = coeff(slot, codes[i]->pivots[p]);
+    mul(bits, codes[i]->fromPivots, coeffs);
+    for (long b=0; b<8; b++)
+      if (IsOne(bits[b]))
+	data[i] |= (1 << b);
+  }
+}
+
+long AESEncoder::cachedSlots() const
+{
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  return nCached;
+}
+
+// A rotation by k along a good dimension is the automorphism X -> X^{g^k}.
+// Along a bad dimension it also needs X -> X^{g^{k-ord}} for the slots that
+// wrap around.
+void rotationAutomorphisms(std::set<long>& vals, const PAlgebra& zMStar,
+			   long i, long k)
+{
+  long ord = zMStar.OrderOf(i);
+  k %= ord;
+  if (k < 0) k += ord;
+  if (k == 0) return;
+  vals.insert(PowerMod(zMStar.ZmStarGen(i), k, zMStar.getM()));
+  if (!zMStar.SameOrd(i))
+    vals.insert(PowerMod(zMStar.ZmStarGen(i), k-ord, zMStar.getM()));
+}
+
+// Apply the GF2-linear map with linearized-polynomial coefficients binMat,
+// i.e. c -> sum_j binMat[j] * c^{2^j}. This is applyLinPolyLL, except that
+// the Frobenius maps are computed on the thread pool.
+static void applyAffine(Ctxt& c, const vector<PolyType>& binMat,
+			const EncryptedArrayDerived<PA_GF2>& /*ea2*/)
+{
+  c.cleanUp();
+
+  long d = binMat.size();
+  vector<Ctxt> terms(d, Ctxt(ZeroCtxtLike, c));
+  NTL_EXEC_RANGE(d-1, first, last)
+  for (long j=first+1; j<last+1; j++) {
+    frobeniusOf(terms[j], c, j);
+    terms[j].multByConstant(binMat[j]);
+  }
+  NTL_EXEC_RANGE_END
+
+  c.multByConstant(binMat[0]);
+  for (long j=1; j<d; j++)
+    c += terms[j];
+  c.cleanUp(); // re-linearize and drop the special primes
+}
+
+// the transformation X -> X^{-1} in GF(2^8), using the S-box engine
+void HomAES::invert(vector<Ctxt>& data) const
+{
+  NTL_EXEC_RANGE(long(data.size()), first, last)
+  for (long i=first; i<last; i++)
+    sbox->invert(data[i], ea2);
+  NTL_EXEC_RANGE_END
+}
+
+void FrobeniusChainSBox::invert(Ctxt& c,
+				const EncryptedArrayDerived<PA_GF2>& /*ea2*/) const
+{
+  Ctxt tmp1(c);           // tmp1 = c = X
+  tmp1.frobeniusAutomorph(1); // tmp1 = X^2   after Z -> Z^2
+  c.multiplyBy(tmp1);     // c    = X^3
+  Ctxt tmp2(c);           // tmp2 = X^3
+  tmp2.frobeniusAutomorph(2); // tmp2 = X^12  after Z -> Z^4
+  tmp1.multiplyBy(tmp2);  // tmp1 = X^14
+  c.multiplyBy(tmp2);     // c    = X^15
+  c.frobeniusAutomorph(4);// c    = X^240 after Z -> Z^16
+  c.multiplyBy(tmp1);     // c    = X^254
+}
+
+void ConjugateProductSBox::invert(Ctxt& c,
+				  const EncryptedArrayDerived<PA_GF2>& /*ea2*/) const
+{
+  c.cleanUp();
+
+  // The conjugates X^{2^i} for i=1,...,7
+  vector<Ctxt> terms(7, Ctxt(ZeroCtxtLike, c));
+  NTL_EXEC_RANGE(7, first, last)
+  for (long i=first; i<last; i++) {
+    frobeniusOf(terms[i], c, i+1);
+    terms[i].cleanUp();
+  }
+  NTL_EXEC_RANGE_END
+
+  // X^254 = X^2 * X^4 * ... * X^128, multiplied in a balanced tree
+  while (terms.size() > 1) {
+    long n = terms.size(), half = n/2;
+    NTL_EXEC_RANGE(half, first, last)
+    for (long i=first; i<last; i++)
+      terms[i].multiplyBy(terms[n-1-i]);
+    NTL_EXEC_RANGE_END
+    terms.resize(n - half, Ctxt(ZeroCtxtLike, c));
   }
+  c = terms[0];
 }
 
 // Pack the ciphertexts in c in as few "fully packed" cipehrtext as possible.
@@ -855,7 +1060,7 @@ static void unackCtxt(vector<Ctxt>& to, const vector<Ctxt>& from,
   }
   // At this point 'to' contains empty (zero) ciphertexts
 
-  long nPacked = divc(nUnpacked, 8);
+  long nPacked = divc(nUnpacked, e);
   for (long idx=0; idx<nPacked; idx++) {
     vector<Ctxt> conjugates(e, from[idx]); // Compute the conjugates, Z^{2^{8j}}
     for (long j=1; j<e; j++)
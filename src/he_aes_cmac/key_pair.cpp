@@ -1,31 +1,71 @@
 #include "he_aes_cmac/key_pair.h"
 
+#include "helib/binio.h"
+
 namespace HeAesCmac {
 
     helib::Context KeyPair::genContext(SecurityParams const &params) {
         helib::Context context(params.m, 2, params.r, params.gens, params.ords);
         context.zMStar.set_cM(params.cm);
-        buildModChain(context, params.k, params.c);
-        //context.makeBootstrappable(helib::convert<NTL::Vec<long>, std::vector<long>>(params.mvec));
+        buildModChain(context, params.k, params.c, params.bootstrap, params.hwsk);
+        if (params.bootstrap) {
+            context.makeBootstrappable(
+                helib::convert<NTL::Vec<long>, std::vector<long>>(params.mvec), params.hwsk);
+        }
         return context;
     }
 
-    KeyPair KeyPair::genKeyPair(helib::Context const &context, unsigned long hw) {
-        // Set up HomAES object
+    KeyPair KeyPair::genKeyPair(helib::Context const &context, unsigned long hw,
+                                bool minimalKeys) {
+        // Set up HomAES object, with the packing constants if bootstrappable
         HomAES homAes(context);
 
         // Generate BGV secret key.
         helib::SecKey sk(context);
         sk.GenSecKey(hw);
-        genKeySwitchingMatrices(sk, context.zMStar.getM());
-        helib::addFrbMatrices(sk);
-        helib::addSome1DMatrices(sk);
-        //sk.genRecryptData();
+        if (minimalKeys) {
+            genMinimalKeySwitchingMatrices(sk, homAes);
+        } else {
+            genKeySwitchingMatrices(sk, context.zMStar.getM());
+        }
+        if (!minimalKeys || context.isBootstrappable()) {
+            // the linear maps of recryption work along all the dimensions
+            helib::addFrbMatrices(sk);
+            helib::addSome1DMatrices(sk);
+        }
+        if (context.isBootstrappable()) {
+            sk.genRecryptData();
+        }
+        sk.setKeySwitchMap();
 
         // pk implicitly extracted from sk
         return KeyPair(PublicKey(sk, homAes), SecretKey(sk, homAes));
     }
 
+    void KeyPair::writeContext(std::ostream &out, helib::Context const &context) {
+        helib::writeContextBaseBinary(out, context);
+        helib::writeContextBinary(out, context);
+        // not part of HElib's format
+        helib::write_raw_double(out, context.zMStar.get_cM());
+    }
+
+    helib::Context KeyPair::readContext(std::istream &in) {
+        unsigned long m, p, r;
+        std::vector<long> gens, ords;
+        helib::readContextBaseBinary(in, m, p, r, gens, ords);
+        helib::Context context(m, p, r, gens, ords);
+        helib::readContextBinary(in, context);
+        context.zMStar.set_cM(helib::read_raw_double(in));
+        return context;
+    }
+
+    KeyPair KeyPair::read(std::istream &in, helib::Context const &context) {
+        helib::SecKey sk(context);
+        helib::readSecKeyBinary(in, sk);
+        HomAES homAes(context);
+        return KeyPair(PublicKey(sk, homAes), SecretKey(sk, homAes));
+    }
+
     KeyPair::KeyPair(PublicKey const &pk, SecretKey const &sk):
         _pk(pk),
         _sk(sk)
@@ -35,10 +75,20 @@ namespace HeAesCmac {
         return _pk;
     }
 
+    PublicKey &KeyPair::pk() {
+        return _pk;
+    }
+
     SecretKey const &KeyPair::sk() const {
         return _sk;
     }
 
+    // The public key is the public part of the secret key, so only the
+    // latter is written.
+    void KeyPair::write(std::ostream &out) const {
+        _sk.write(out);
+    }
+
     void KeyPair::genKeySwitchingMatrices(helib::SecKey &sk, unsigned long m) {
         long ord = sk.getContext().zMStar.OrderOf(0);
         // rotation along 1st dim by size i * ord / 16
@@ -52,4 +102,13 @@ namespace HeAesCmac {
             sk.GenKeySWmatrix(1, NTL::InvMod(val,m));
         }
     }
+
+    void KeyPair::genMinimalKeySwitchingMatrices(helib::SecKey &sk, HomAES const &homAes) {
+        std::set<long> vals;
+        PublicKey(sk, homAes).automorphisms(vals);
+        for (long val : vals) {
+            // From s(X^val) to s(X)
+            sk.GenKeySWmatrix(1, val);
+        }
+    }
 }
\ No newline at end of file
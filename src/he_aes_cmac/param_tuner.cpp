@@ -0,0 +1,175 @@
+#include "he_aes_cmac/param_tuner.h"
+
+#include <chrono>
+#include <stdexcept>
+
+#include "cryptopp/aes.h"
+#include "cryptopp/cmac.h"
+#include "cryptopp/filters.h"
+#include "he_aes_cmac/key_pair.h"
+#include "he_aes_cmac/cmac_keys_ctxt.h"
+
+namespace HeAesCmac {
+
+    std::vector<RingCandidate> ParamTuner::defaultRings() {
+        return {
+            {4369, {17, 257}, {258, 4115}, {16, -16}},
+            {28679, {17, 7, 241}, {15184, 4098, 28204}, {16, 6, -10}},
+            {65281, {}, {43073, 22214}, {96, -14}}
+        };
+    }
+
+    ParamTuner::ParamTuner(size_t maxKeyLength, double securityLevel, bool bootstrap,
+                           std::vector<RingCandidate> const &rings):
+        _maxKeyLength(maxKeyLength),
+        _securityLevel(securityLevel),
+        _bootstrap(bootstrap),
+        _rings(rings)
+    {
+        if (_maxKeyLength == 0) {
+            throw std::invalid_argument("The trial CMAC needs a key of at least one byte.");
+        }
+    }
+
+    TuningResult ParamTuner::tune(CryptoPP::RandomNumberGenerator &rng,
+                                  std::ostream *log) const {
+        bool found = false;
+        TuningResult best;
+        for (auto const &ring : _rings) {
+            if (_bootstrap && ring.mvec.empty()) {
+                continue;
+            }
+            for (long c : {2, 3}) {
+                // more bits only make the computation slower and less secure,
+                // so the first k that works is the best one for this m and c
+                for (long k : candidateBits(_bootstrap)) {
+                    SecurityParams params;
+                    params.m = ring.m;
+                    params.r = 1;
+                    params.cm = 1;
+                    params.k = k;
+                    params.c = c;
+                    params.hwsk = (_bootstrap ? 120 : 64);
+                    params.mvec = ring.mvec;
+                    params.gens = ring.gens;
+                    params.ords = ring.ords;
+                    params.bootstrap = _bootstrap;
+                    params.minimalKeys = true;
+
+                    TuningResult result;
+                    result.params = params;
+                    bool valid = false;
+                    try {
+                        helib::Context context(KeyPair::genContext(params));
+                        std::string reason;
+                        if (!checkContext(context, result.security, reason)) {
+                            if (log) {
+                                *log << "m=" << params.m << " k=" << k << " c=" << c
+                                     << ": rejected (" << reason << ")" << std::endl;
+                            }
+                            // the slots do not depend on k, and the security
+                            // only decreases with it
+                            break;
+                        }
+                        result.slots = context.ea->size();
+                        valid = trialCmac(rng, context, params, result);
+                    } catch (std::exception const &e) {
+                        if (log) {
+                            *log << "m=" << params.m << " k=" << k << " c=" << c
+                                 << ": failed (" << e.what() << ")" << std::endl;
+                        }
+                        continue;
+                    }
+
+                    if (log) {
+                        *log << "m=" << params.m << " k=" << k << " c=" << c
+                             << ": security " << result.security;
+                        if (valid) {
+                            *log << ", capacity used " << result.capacityUsed
+                                 << " bits, " << result.seconds << " seconds";
+                        } else {
+                            *log << ", wrong CMAC";
+                        }
+                        *log << std::endl;
+                    }
+                    if (valid) {
+                        if (!found || result.seconds < best.seconds) {
+                            best = result;
+                            found = true;
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+        if (!found) {
+            throw std::runtime_error("No valid parameters found.");
+        }
+        return best;
+    }
+
+    std::vector<long> ParamTuner::candidateBits(bool bootstrap) {
+        std::vector<long> bits;
+        // bootstrapping needs room for the recryption circuit itself
+        for (long k = (bootstrap ? 600 : 300); k <= 1600; k += 100) {
+            bits.push_back(k);
+        }
+        return bits;
+    }
+
+    bool ParamTuner::checkContext(helib::Context const &context, double &security,
+                                  std::string &reason) const {
+        security = context.securityLevel();
+        if (security < _securityLevel) {
+            reason = "security " + std::to_string(security);
+            return false;
+        }
+        // HomAES needs GF(2^8) in the slots, and 16 bytes per block along
+        // the first dimension
+        if (context.zMStar.getOrdP() % 8 != 0) {
+            reason = "order of 2 is " + std::to_string(context.zMStar.getOrdP())
+                     + ", not a multiple of 8";
+            return false;
+        }
+        if (context.zMStar.OrderOf(0) % CryptoPP::AES::BLOCKSIZE != 0) {
+            reason = "first dimension has " + std::to_string(context.zMStar.OrderOf(0))
+                     + " slots, not a multiple of 16";
+            return false;
+        }
+        return true;
+    }
+
+    bool ParamTuner::trialCmac(CryptoPP::RandomNumberGenerator &rng,
+                               helib::Context const &context,
+                               SecurityParams const &params,
+                               TuningResult &result) const {
+        KeyPair keys(KeyPair::genKeyPair(context, params.hwsk, params.minimalKeys));
+
+        std::vector<CryptoPP::byte> aesKey(CryptoPP::AES::DEFAULT_KEYLENGTH);
+        std::vector<CryptoPP::byte> message(_maxKeyLength);
+        rng.GenerateBlock(aesKey.data(), aesKey.size());
+        rng.GenerateBlock(message.data(), message.size());
+        CmacKeysCtxt cmacKeys(CmacKeysCtxt::genKeysCtxt(aesKey, keys.pk()));
+
+        std::vector<helib::Ctxt> input;
+        keys.pk().encryptBlocks(message, input);
+        helib::Ctxt output(keys.pk().pk());
+        long freshCapacity = input.front().bitCapacity();
+
+        auto start(std::chrono::steady_clock::now());
+        keys.pk().heAesCmac(cmacKeys, input,
+                            message.size() % CryptoPP::AES::BLOCKSIZE != 0, output);
+        std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() - start);
+        result.seconds = elapsed.count();
+        result.capacityUsed = freshCapacity - output.bitCapacity();
+
+        std::vector<CryptoPP::byte> heTag;
+        keys.sk().decryptBlock(output, heTag);
+
+        std::string tag;
+        CryptoPP::CMAC<CryptoPP::AES> cmac(aesKey.data(), aesKey.size());
+        CryptoPP::VectorSource(message, true,
+            new CryptoPP::HashFilter(cmac, new CryptoPP::StringSink(tag)));
+        return output.isCorrect() && std::string(heTag.cbegin(), heTag.cend()) == tag;
+    }
+}
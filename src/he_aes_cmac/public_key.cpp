@@ -1,7 +1,12 @@
 #include "he_aes_cmac/public_key.h"
 #include "he_aes_cmac/cmac_keys_ctxt.h"
 
+#include <algorithm>
 #include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include "NTL/BasicThreadPool.h"
 
 namespace HeAesCmac {
 
@@ -39,8 +44,21 @@ namespace HeAesCmac {
 
     void PublicKey::encryptBlock(std::vector<CryptoPP::byte> const &input,
                                  helib::Ctxt &output) const {
+        NTL::ZZX encodedBytes;
+        _heAes.getEncoder().encode(encodedBytes, input);
+        _pk.Encrypt(output, encodedBytes);
+    }
+
+    void PublicKey::encryptReplicatedBlock(std::vector<CryptoPP::byte> const &input,
+                                           helib::Ctxt &output) const {
+        // copy the block into every lane, so it can be masked into any of them
+        std::vector<CryptoPP::byte> blocks;
+        blocks.reserve(lanes() * CryptoPP::AES::BLOCKSIZE);
+        for (long i = 0; i != lanes(); ++i) {
+            blocks.insert(blocks.end(), input.cbegin(), input.cend());
+        }
         NTL::Vec<NTL::ZZX> encodedBytes;
-        encode4AES(encodedBytes, input, _heAes.getEA());
+        encode4AES(encodedBytes, blocks, _heAes.getEA());
         _pk.Encrypt(output, encodedBytes[0]);
     }
 
@@ -50,6 +68,46 @@ namespace HeAesCmac {
         _heAes.encryptAESkey(output, aesKey, _pk);
     }
 
+    void PublicKey::encryptZero(helib::Ctxt &output) const {
+        _pk.Encrypt(output, NTL::ZZX());
+    }
+
+    void PublicKey::rerandomize(helib::Ctxt &ctxt) const {
+        helib::Ctxt zero(_pk);
+        encryptZero(zero);
+        ctxt += zero;
+    }
+
+    // Turns AES-ECB encrypted blocks into HE encryptions of the plaintext
+    // blocks, given the HE encryption of the AES key (see encryptAesKey).
+    // All the blocks are decrypted by a single homAESdec pass, packed in the
+    // lanes, and then each output holds its block in lane 0, like the output
+    // of encryptBlocks. The context needs the depth of a full AES decryption
+    // on top of that of the CMAC, or to be bootstrappable.
+    void PublicKey::transcipherBlocks(std::vector<helib::Ctxt> const &aesKey,
+                                      std::vector<CryptoPP::byte> const &input,
+                                      std::vector<helib::Ctxt> &output) const {
+        if (input.size() % CryptoPP::AES::BLOCKSIZE != 0) {
+            throw std::invalid_argument("AES ciphertext is not a whole number of blocks.");
+        }
+        size_t nBlocks = input.size() / CryptoPP::AES::BLOCKSIZE;
+        output.assign(nBlocks, helib::Ctxt(_pk));
+        if (nBlocks == 0) {
+            return;
+        }
+
+        std::vector<helib::Ctxt> packed;
+        _heAes.homAESdec(packed, aesKey, input);
+
+        size_t nLanes = lanes();
+        _heAes.useThreads();
+        NTL_EXEC_RANGE(long(nBlocks), first, last)
+        for (long i = first; i != last; ++i) {
+            extractLane(packed[i / nLanes], i % nLanes, output[i]);
+        }
+        NTL_EXEC_RANGE_END
+    }
+
     void PublicKey::heAesCmac(CmacKeysCtxt const &key,
                               std::vector<helib::Ctxt> const &input,
                               bool padded,
@@ -62,6 +120,235 @@ namespace HeAesCmac {
             }
             _heAes.homAESenc(tmp, key.aesKey());
         }
+        // the other lanes hold AES encryptions under the hash key (of zero,
+        // then of those), which the PS must not see when it decrypts
+        NTL::ZZX mask;
+        laneMask({0}, mask);
         output = tmp[0];
+        output.multByConstant(mask);
+    }
+
+    // Each output holds its CMAC in lane 0, like the single-input version.
+    void PublicKey::heAesCmac(CmacKeysCtxt const &key,
+                              std::vector<std::vector<helib::Ctxt>> const &inputs,
+                              std::vector<bool> const &padded,
+                              std::vector<helib::Ctxt> &output) const {
+        std::vector<helib::Ctxt> packed;
+        heAesCmacPacked(key, inputs, padded, packed);
+
+        size_t nLanes = lanes();
+        output.assign(inputs.size(), helib::Ctxt(_pk));
+        _heAes.useThreads();
+        NTL_EXEC_RANGE(long(inputs.size()), first, last)
+        for (long i = first; i != last; ++i) {
+            extractLane(packed[i / nLanes], i % nLanes, output[i]);
+        }
+        NTL_EXEC_RANGE_END
+    }
+
+    // Computes the CMAC of many independent inputs at once. Input i is moved
+    // into lane i % lanes() of ciphertext i / lanes(), so every position of the
+    // CBC chains costs a single homAESenc pass over all the packed ciphertexts.
+    void PublicKey::heAesCmacPacked(CmacKeysCtxt const &key,
+                                    std::vector<std::vector<helib::Ctxt>> const &inputs,
+                                    std::vector<bool> const &padded,
+                                    std::vector<helib::Ctxt> &output) const {
+        size_t nLanes = lanes();
+        size_t nPacked = (inputs.size() + nLanes - 1) / nLanes;
+        size_t chainLength = 0;
+        for (size_t i = 0; i != inputs.size(); ++i) {
+            chainLength = std::max(chainLength, inputs[i].size());
+        }
+
+        output.assign(nPacked, helib::Ctxt(_pk));
+        std::vector<helib::Ctxt> tmp(nPacked, helib::Ctxt(_pk));
+        _heAes.useThreads();
+        for (size_t pos = 0; pos != chainLength; ++pos) {
+            // the rotations into the lanes are independent, run them on the pool
+            std::vector<helib::Ctxt> blocks(inputs.size(), helib::Ctxt(_pk));
+            NTL_EXEC_RANGE(long(inputs.size()), first, last)
+            for (long i = first; i != last; ++i) {
+                long lane = i % nLanes;
+                if (pos < inputs[i].size()) {
+                    blocks[i] = inputs[i][pos];
+                    rotateLane(blocks[i], lane, false);
+                }
+            }
+            NTL_EXEC_RANGE_END
+
+            std::vector<std::vector<long>> key1Lanes(nPacked), key2Lanes(nPacked);
+            std::vector<std::vector<long>> endLanes(nPacked);
+            for (size_t i = 0; i != inputs.size(); ++i) {
+                if (pos >= inputs[i].size()) {
+                    continue;
+                }
+                tmp[i / nLanes] += blocks[i];
+                if (pos + 1 == inputs[i].size()) {
+                    (padded[i] ? key2Lanes : key1Lanes)[i / nLanes].push_back(i % nLanes);
+                    endLanes[i / nLanes].push_back(i % nLanes);
+                }
+            }
+
+            // the last block of a chain is combined with its subkey
+            for (size_t j = 0; j != nPacked; ++j) {
+                NTL::ZZX mask;
+                if (!key1Lanes[j].empty()) {
+                    helib::Ctxt subKey(key.packedKey1());
+                    laneMask(key1Lanes[j], mask);
+                    subKey.multByConstant(mask);
+                    tmp[j] += subKey;
+                }
+                if (!key2Lanes[j].empty()) {
+                    helib::Ctxt subKey(key.packedKey2());
+                    laneMask(key2Lanes[j], mask);
+                    subKey.multByConstant(mask);
+                    tmp[j] += subKey;
+                }
+            }
+
+            _heAes.homAESenc(tmp, key.aesKey());
+
+            // keep only the lanes of the chains that ended at this position.
+            // Even when they all end together the rest is masked out: the
+            // unused lanes hold AES encryptions of zero under the hash key
+            // (the CMAC subkey base L and its iterates), and the outputs are
+            // decrypted whole by the PS.
+            for (size_t j = 0; j != nPacked; ++j) {
+                if (endLanes[j].empty()) {
+                    continue;
+                }
+                NTL::ZZX mask;
+                helib::Ctxt ended(tmp[j]);
+                laneMask(endLanes[j], mask);
+                ended.multByConstant(mask);
+                output[j] += ended;
+            }
+        }
+    }
+
+    // Switching from modulus q to q' scales the noise by q'/q and adds the
+    // rounding noise, so the primes are dropped while q' stays above twice
+    // that bound, with a few bits to spare.
+    void PublicKey::modSwitchForDecryption(helib::Ctxt &ctxt) const {
+        static NTL::xdouble const margin(16.0);
+        if (ctxt.isEmpty()) {
+            return;
+        }
+        ctxt.cleanUp();
+        helib::Context const &context(ctxt.getContext());
+        helib::IndexSet primes(ctxt.getPrimeSet());
+        NTL::xdouble noise(ctxt.getNoiseBound());
+        NTL::xdouble addedNoise(ctxt.modSwitchAddedNoiseBound());
+        double logQ = context.logOfProduct(primes);
+        while (primes.card() > 1) {
+            helib::IndexSet smaller(primes);
+            smaller.remove(smaller.last());
+            double logSmaller = context.logOfProduct(smaller);
+            NTL::xdouble switchedNoise(noise * NTL::xexp(logSmaller - logQ) + addedNoise);
+            if (NTL::xexp(logSmaller) <= 2 * margin * switchedNoise) {
+                break;
+            }
+            primes = smaller;
+        }
+        if (primes != ctxt.getPrimeSet()) {
+            ctxt.modDownToSet(primes);
+        }
+    }
+
+    std::string PublicKey::serializeForDecryption(helib::Ctxt &ctxt) const {
+        modSwitchForDecryption(ctxt);
+        std::ostringstream out;
+        ctxt.write(out);
+        return out.str();
+    }
+
+    long PublicKey::lanes() const {
+        return _heAes.getEA().size() / CryptoPP::AES::BLOCKSIZE;
+    }
+
+    void PublicKey::setThreads(long n) {
+        _heAes.setThreads(n);
+    }
+
+    long PublicKey::threads() const {
+        return _heAes.getThreads();
+    }
+
+    void PublicKey::useThreads() const {
+        _heAes.useThreads();
+    }
+
+    void PublicKey::setSBox(std::shared_ptr<const SBoxEngine> engine) {
+        // the key-switching matrices may be the minimal set of another engine
+        helib::PAlgebra const &zMStar(_pk.getContext().zMStar);
+        for (long j : engine->frobeniusPowers()) {
+            if (!_pk.isReachable(zMStar.frobeniusPow(j))) {
+                throw std::invalid_argument(
+                    "The key-switching matrices do not support the S-box engine.");
+            }
+        }
+        _heAes.setSBox(engine);
+    }
+
+    void PublicKey::automorphisms(std::set<long> &vals) const {
+        _heAes.automorphisms(vals);
+        // the rotations between lane 0 and the other lanes, see rotateLane
+        helib::PAlgebra const &zMStar(_pk.getContext().zMStar);
+        for (long lane = 1; lane < lanes(); ++lane) {
+            for (long i = 0; i != zMStar.numOfGens(); ++i) {
+                long coord = zMStar.coordinate(i, lane);
+                rotationAutomorphisms(vals, zMStar, i, coord);
+                rotationAutomorphisms(vals, zMStar, i, -coord);
+            }
+        }
+    }
+
+    long PublicKey::keySwitchingMatrices() const {
+        return _pk.keySWlist().size();
+    }
+
+    long PublicKey::keySwitchingBytes() const {
+        long bytes = 0;
+        long phiM = _pk.getContext().zMStar.getPhiM();
+        for (auto const &matrix : _pk.keySWlist()) {
+            // only the top row is stored, the bottom one comes from a seed
+            for (auto const &part : matrix.b) {
+                bytes += helib::card(part.getIndexSet()) * phiM * sizeof(long);
+            }
+        }
+        return bytes;
+    }
+
+    void PublicKey::laneMask(std::vector<long> const &lanes, NTL::ZZX &mask) const {
+        std::vector<CryptoPP::byte> bytes(this->lanes() * CryptoPP::AES::BLOCKSIZE, 0);
+        for (long lane : lanes) {
+            std::fill_n(std::next(bytes.begin(), lane * CryptoPP::AES::BLOCKSIZE),
+                        CryptoPP::AES::BLOCKSIZE, 1);
+        }
+        _heAes.getEncoder().encode(mask, bytes);
+    }
+
+    // Moves the block in the given lane of packed to lane 0, zeroing the rest
+    void PublicKey::extractLane(helib::Ctxt const &packed, long lane,
+                                helib::Ctxt &output) const {
+        NTL::ZZX mask;
+        laneMask({lane}, mask);
+        output = packed;
+        output.multByConstant(mask);
+        rotateLane(output, lane, true);
+    }
+
+    // Moves a block from lane 0 to the given lane, or back if inverse. The
+    // block is alone in the ciphertext, so instead of a rotation of the
+    // whole hypercube this only rotates along each dimension by the
+    // coordinate of the lane, which needs far fewer key-switching matrices.
+    void PublicKey::rotateLane(helib::Ctxt &ctxt, long lane, bool inverse) const {
+        helib::PAlgebra const &zMStar(_pk.getContext().zMStar);
+        for (long i = 0; i != zMStar.numOfGens(); ++i) {
+            long coord = zMStar.coordinate(i, lane);
+            if (coord != 0) {
+                _heAes.getEA().rotate1D(ctxt, i, inverse ? -coord : coord);
+            }
+        }
     }
-}
\ No newline at end of file
+}
@@ -22,9 +22,20 @@ namespace HeAesCmac {
 
     void SecretKey::decryptBlock(helib::Ctxt const &input,
                                  std::vector<CryptoPP::byte> &output) const {
-        NTL::Vec<NTL::ZZX> ptxt(NTL::INIT_SIZE, 1);
-        _sk.Decrypt(ptxt[0], input);
-        decode4AES(output, ptxt, _heAes.getEA());
-        output.resize(CryptoPP::AES::BLOCKSIZE);
+        // only the block in lane 0 is read, so decode just its slots
+        NTL::ZZX ptxt;
+        _sk.Decrypt(ptxt, input);
+        _heAes.getEncoder().decode(output, ptxt, CryptoPP::AES::BLOCKSIZE);
+    }
+
+    void SecretKey::decryptLanes(helib::Ctxt const &input, long nLanes,
+                                 std::vector<CryptoPP::byte> &output) const {
+        NTL::ZZX ptxt;
+        _sk.Decrypt(ptxt, input);
+        _heAes.getEncoder().decode(output, ptxt, nLanes * CryptoPP::AES::BLOCKSIZE);
+    }
+
+    void SecretKey::write(std::ostream &out) const {
+        helib::writeSecKeyBinary(out, _sk);
     }
 }
\ No newline at end of file
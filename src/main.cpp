@@ -1,9 +1,15 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <vector>
 #include <utility>
 #include <cmath>
+#include <future>
+#include <thread>
 
 #include "pre/pre_scheme.h"
 #include "pre/key_pair.h"
@@ -19,6 +25,7 @@
 #include "cryptopp/aes.h"
 
 #include "muse/client.h"
+#include "he_aes_cmac/param_tuner.h"
 
 struct ExperimentParams {
     std::string _message;
@@ -30,6 +37,14 @@ struct ExperimentParams {
     size_t _searchKeysPerDocument;
     size_t _totalDocuments;
     bool _sameSearchKeys;
+    long _heThreads;
+    std::shared_ptr<const SBoxEngine> _heSBox;
+    bool _transcipher;
+    size_t _searchKeyCacheSize;
+    bool _rerandomizeCached;
+    size_t _hashPipelineQueue;  // 0 disables the hash pipeline.
+    size_t _reencryptionCacheSize;
+    bool _precomputeOnGrant;
 };
 
 ExperimentParams baseSetup() {
@@ -43,6 +58,8 @@ ExperimentParams baseSetup() {
     setup._heSecurityParams.mvec = {};
     setup._heSecurityParams.gens = {43073, 22214};
     setup._heSecurityParams.ords = {96, -14};
+    setup._heSecurityParams.bootstrap = false;
+    setup._heSecurityParams.minimalKeys = false;
     setup._repeatAmount = 10;
     setup._preSecurityParam = 1024;
     setup._searchKeySize = 8;       // 8 bytes
@@ -50,6 +67,29 @@ ExperimentParams baseSetup() {
     setup._searchKeysPerDocument = 1;
     setup._totalDocuments = 1;
     setup._sameSearchKeys = false;
+    setup._heThreads = 1;
+    setup._heSBox = std::make_shared<FrobeniusChainSBox>();
+    setup._transcipher = false;
+    setup._searchKeyCacheSize = 0;
+    setup._rerandomizeCached = false;
+    setup._hashPipelineQueue = 0;
+    setup._reencryptionCacheSize = 0;
+    setup._precomputeOnGrant = false;
+    return setup;
+}
+
+// Small parameters, relying on bootstrapping rather than a long modulus
+// chain to evaluate CMAC chains of any length.
+ExperimentParams bootstrapSetup() {
+    ExperimentParams setup(baseSetup());
+    setup._heSecurityParams.m = 28679;
+    setup._heSecurityParams.k = 900;
+    setup._heSecurityParams.c = 3;
+    setup._heSecurityParams.hwsk = 120;
+    setup._heSecurityParams.mvec = {17, 7, 241};
+    setup._heSecurityParams.gens = {15184, 4098, 28204};
+    setup._heSecurityParams.ords = {16, 6, -10};
+    setup._heSecurityParams.bootstrap = true;
     return setup;
 }
 
@@ -63,11 +103,29 @@ void runExperiment(ExperimentParams const &params) {
     CryptoPP::AutoSeededRandomPool rng;
     CryptoPP::ThreadUserTimer timer;
     muse::PrivacyService ps(rng, params._heSecurityParams);
+    ps.setHeThreads(params._heThreads);
+    ps.setHeSBox(params._heSBox);
     muse::DataStorageService ds(params._preSecurityParam, params._preSecurityParam,
                                 params._preSecurityParam, rng, ps);
+    ds.setReencryptionCache(params._reencryptionCacheSize, params._precomputeOnGrant);
     muse::Client client0(0, params._searchKeySize, ds);
     muse::Client client1(1, params._searchKeySize, ds);
-    client0.grantAccess(1, client1.prePk());
+    // with precomputation, grant once the documents are there to re-encrypt
+    if (!params._precomputeOnGrant) {
+        client0.grantAccess(1, client1.prePk());
+    }
+    if (params._transcipher) {
+        std::vector<CryptoPP::byte> aesKey(CryptoPP::AES::DEFAULT_KEYLENGTH);
+        rng.GenerateBlock(aesKey.data(), aesKey.size());
+        client0.useTranscipher(aesKey);
+        rng.GenerateBlock(aesKey.data(), aesKey.size());
+        client1.useTranscipher(aesKey);
+    }
+    client0.setSearchKeyCache(params._searchKeyCacheSize, params._rerandomizeCached);
+    client1.setSearchKeyCache(params._searchKeyCacheSize, params._rerandomizeCached);
+    if (params._hashPipelineQueue != 0) {
+        ds.enableHashPipeline(params._hashPipelineQueue);
+    }
 
     std::string content(params._documentSize, UCHAR_MAX);
     CryptoPP::Integer document(content.c_str());
@@ -82,13 +140,31 @@ void runExperiment(ExperimentParams const &params) {
     }
 
     size_t dId = 0;
+    auto ingestStart(std::chrono::steady_clock::now());
+    std::vector<std::future<void>> pending;
     for (auto it = searchKeys.cbegin(); it != searchKeys.cend(); std::advance(it, params._searchKeysPerDocument)) {
         std::vector<std::string> currentSearchKeys(it, std::next(it, params._searchKeysPerDocument));
         timer.StartTimer();
-        client0.store(currentSearchKeys, document);
-        std::cout << "Stored document " << ++dId << " in "
-                  << timer.ElapsedTimeAsDouble()
-                  << " seconds." << std::endl;
+        if (params._hashPipelineQueue != 0) {
+            pending.push_back(client0.storeAsync(currentSearchKeys, document));
+            std::cout << "Submitted document " << ++dId << " in ";
+        } else {
+            client0.store(currentSearchKeys, document);
+            std::cout << "Stored document " << ++dId << " in ";
+        }
+        std::cout << timer.ElapsedTimeAsDouble() << " seconds." << std::endl;
+    }
+    for (auto &stored : pending) {
+        stored.get();
+    }
+    // wall-clock time, since the pipeline works on other threads
+    std::chrono::duration<double> ingestTime(std::chrono::steady_clock::now() - ingestStart);
+    std::cout << "Ingested " << params._totalDocuments << " documents in "
+              << ingestTime.count() << " seconds ("
+              << params._totalDocuments / ingestTime.count()
+              << " documents per second)." << std::endl;
+    if (params._precomputeOnGrant) {
+        client0.grantAccess(1, client1.prePk());
     }
 
     timer.StartTimer();
@@ -102,6 +178,29 @@ void runExperiment(ExperimentParams const &params) {
     std::cout << "Retrieved " << resultC1.size() << " documents for client1 in "
             << timer.ElapsedTimeAsDouble()
             << " seconds." << std::endl;
+
+    pre::PreScheme const &preScheme(ds.preScheme());
+    std::cout << "PRE proofs checked: " << preScheme.validations()
+              << ", skipped: " << preScheme.skippedValidations() << " ("
+              << preScheme.skippedValidations() * pre::PreScheme::VALIDATION_EXPONENTIATIONS
+              << " exponentiations saved)." << std::endl;
+
+    if (params._reencryptionCacheSize != 0) {
+        timer.StartTimer();
+        resultC1 = client1.search(searchKeys.front());
+        std::cout << "Retrieved " << resultC1.size() << " documents for client1 again in "
+                  << timer.ElapsedTimeAsDouble()
+                  << " seconds." << std::endl;
+        muse::ReencryptionCache const &cache(ds.reencryptionCache());
+        std::cout << "Re-encryption cache: " << cache.hits() << " hits, "
+                  << cache.misses() << " misses." << std::endl;
+    }
+
+    if (params._searchKeyCacheSize != 0) {
+        muse::SearchKeyCache const &cache(client0.searchKeyCache());
+        std::cout << "client0 search-key cache: " << cache.hits() << " hits, "
+                  << cache.misses() << " misses." << std::endl;
+    }
 }
 
 void repeatExperiment(ExperimentParams const &params) {
@@ -185,17 +284,343 @@ void documentsPerSearchKeyExperiment() {
     }
 }
 
+// Same workload as documentsPerSearchKeyExperiment, with the client reusing
+// its encrypted search keys.
+void searchKeyCacheExperiment() {
+    ExperimentParams experiment(baseSetup());
+    experiment._sameSearchKeys = true;
+    experiment._totalDocuments = 16;
+    experiment._searchKeyCacheSize = 64;
+
+    for (bool rerandomize : {false, true}) {
+        experiment._rerandomizeCached = rerandomize;
+        std::string message("Search-key cache experiment, rerandomize ");
+        message.append(rerandomize ? "on" : "off");
+        experiment._message = message;
+        repeatExperiment(experiment);
+    }
+}
+
+// Bulk ingestion with and without the DSS hashing the search keys of one
+// document while the PS handles those of the previous one.
+void hashPipelineExperiment() {
+    ExperimentParams experiment(baseSetup());
+    experiment._totalDocuments = 16;
+    experiment._searchKeysPerDocument = 4;
+
+    for (size_t queue : {0, 4, 16}) {
+        experiment._hashPipelineQueue = queue;
+        std::string message("Hash pipeline experiment, queue capacity ");
+        message.append(std::to_string(queue));
+        experiment._message = message;
+        repeatExperiment(experiment);
+    }
+}
+
+// Each client stores its documents and then searches from a thread of its
+// own, against a single DSS.
+void concurrentClientsExperiment() {
+    ExperimentParams params(baseSetup());
+    params._totalDocuments = 4;
+    size_t searchesPerClient = 4;
+    size_t maxClients = std::max(1u, std::thread::hardware_concurrency());
+    CryptoPP::AutoSeededRandomPool rng;
+    muse::PrivacyService ps(rng, params._heSecurityParams);
+    std::string content(params._documentSize, UCHAR_MAX);
+    CryptoPP::Integer document(content.c_str());
+
+    for (size_t clients = 1; clients <= maxClients; clients *= 2) {
+        muse::DataStorageService ds(params._preSecurityParam, params._preSecurityParam,
+                                    params._preSecurityParam, rng, ps);
+        std::vector<std::unique_ptr<muse::Client>> clientList;
+        for (size_t i = 0; i != clients; ++i) {
+            clientList.emplace_back(new muse::Client(i, params._searchKeySize, ds));
+        }
+
+        auto start(std::chrono::steady_clock::now());
+        std::vector<std::thread> threads;
+        for (auto &client : clientList) {
+            threads.emplace_back([&params, &document, &client, searchesPerClient]() {
+                for (size_t i = 0; i != params._totalDocuments; ++i) {
+                    client->store({intToStringOfSize(i, params._searchKeySize)}, document);
+                }
+                for (size_t i = 0; i != searchesPerClient; ++i) {
+                    client->search(intToStringOfSize(i % params._totalDocuments,
+                                                     params._searchKeySize));
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() - start);
+        std::cout << clients << " clients: "
+                  << clients * (params._totalDocuments + searchesPerClient) / elapsed.count()
+                  << " operations per second." << std::endl;
+    }
+}
+
+// Delegate searches over documents that all share a search key, with the
+// re-encryptions cached after the first search, or computed when access is
+// granted.
+void reencryptionCacheExperiment() {
+    ExperimentParams experiment(baseSetup());
+    experiment._sameSearchKeys = true;
+    experiment._totalDocuments = 16;
+    experiment._reencryptionCacheSize = 64;
+
+    for (bool precompute : {false, true}) {
+        experiment._precomputeOnGrant = precompute;
+        std::string message("Re-encryption cache experiment, precompute ");
+        message.append(precompute ? "on" : "off");
+        experiment._message = message;
+        repeatExperiment(experiment);
+    }
+}
+
+void bootstrapSearchKeySizeExperiment() {
+    ExperimentParams experiment(bootstrapSetup());
+    size_t base = 16;
+
+    for (size_t i = 1; i != 9; i *= 2) {
+        experiment._searchKeySize = i * base;
+        std::string message("Bootstrapping search-key size experiment, size ");
+        message.append(std::to_string(experiment._searchKeySize));
+        experiment._message = message;
+        repeatExperiment(experiment);
+    }
+}
+
+void threadScalingExperiment() {
+    ExperimentParams experiment(baseSetup());
+    long maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (long i = 1; i <= maxThreads; i *= 2) {
+        experiment._heThreads = i;
+        std::string message("Thread scaling experiment, threads ");
+        message.append(std::to_string(experiment._heThreads));
+        experiment._message = message;
+        repeatExperiment(experiment);
+    }
+}
+
+// The key switches done so far, as counted by HElib. Hoisted rotations are
+// not counted.
+long keySwitchCount() {
+    helib::FHEtimer const *timer = helib::getTimerByName("keySwitchPart");
+    return timer ? timer->getNumCalls() : 0;
+}
+
+// Encrypts one block with HE-AES, alone, and prints the key switches and the
+// time per round.
+void measureAesRounds(HeAesCmac::SecurityParams const &params,
+                      std::shared_ptr<const SBoxEngine> const &engine) {
+    CryptoPP::AutoSeededRandomPool rng;
+    helib::Context context(HeAesCmac::KeyPair::genContext(params));
+    HeAesCmac::KeyPair keys(HeAesCmac::KeyPair::genKeyPair(context, params.hwsk,
+                                                           params.minimalKeys));
+    keys.pk().setSBox(engine);
+
+    std::vector<CryptoPP::byte> aesKey(CryptoPP::AES::DEFAULT_KEYLENGTH);
+    std::vector<CryptoPP::byte> block(CryptoPP::AES::BLOCKSIZE);
+    rng.GenerateBlock(aesKey.data(), aesKey.size());
+    rng.GenerateBlock(block.data(), block.size());
+    std::vector<helib::Ctxt> eKey, eData;
+    keys.pk().encryptAesKey(aesKey, eKey);
+    keys.pk().encryptBlocks(block, eData);
+
+    helib::resetAllTimers();
+    long before = keySwitchCount();
+    keys.pk().heAes().homAESenc(eData, eKey);
+    long rounds = eKey.size() - 1;
+    std::cout << "key switches per round: "
+              << double(keySwitchCount() - before) / rounds << std::endl;
+    helib::printNamedTimer(std::cout, "homAESencRound");
+    helib::printNamedTimer(std::cout, "homAESencByteSub");
+    helib::printNamedTimer(std::cout, "homAESencLinear");
+}
+
+void sBoxExperiment() {
+    ExperimentParams experiment(baseSetup());
+    std::vector<std::shared_ptr<const SBoxEngine>> engines{
+        std::make_shared<FrobeniusChainSBox>(),
+        std::make_shared<ConjugateProductSBox>()
+    };
+
+    for (auto const &engine : engines) {
+        experiment._heSBox = engine;
+        std::string message("S-box experiment, engine ");
+        message.append(engine->name());
+        message.append(", depth ");
+        message.append(std::to_string(engine->depth()));
+        experiment._message = message;
+        std::cout << message << std::endl;
+        measureAesRounds(experiment._heSecurityParams, engine);
+        helib::resetAllTimers();
+        repeatExperiment(experiment);
+        // per-round timings of the CMAC evaluations
+        helib::printNamedTimer(std::cout, "homAESencRound");
+        helib::printNamedTimer(std::cout, "homAESencByteSub");
+        helib::printNamedTimer(std::cout, "homAESencLinear");
+        std::cout << std::endl;
+    }
+}
+
+// The search keys are sent AES encrypted and decrypted homomorphically by the
+// DSS, which needs the depth of bootstrapping.
+void transcipherExperiment() {
+    ExperimentParams experiment(bootstrapSetup());
+    experiment._transcipher = true;
+    size_t base = 16;
+
+    for (size_t i = 1; i != 9; i *= 2) {
+        experiment._searchKeySize = i * base;
+        std::string message("Transciphering search-key size experiment, size ");
+        message.append(std::to_string(experiment._searchKeySize));
+        experiment._message = message;
+        repeatExperiment(experiment);
+    }
+}
+
 void viewContextInfo(HeAesCmac::SecurityParams const &params) {
     helib::Context context(HeAesCmac::KeyPair::genContext(params));
     std::cout << "security: " << context.securityLevel() << std::endl;
     std::cout << "slots: " << context.ea->getPAlgebra().getNSlots() << std::endl;
+    std::cout << "bootstrappable: " << context.isBootstrappable() << std::endl;
+}
+
+void viewMemoryInfo(ExperimentParams const &params) {
+    CryptoPP::AutoSeededRandomPool rng;
+    muse::PrivacyService ps(rng, params._heSecurityParams);
+    muse::DataStorageService ds(params._preSecurityParam, params._preSecurityParam,
+                                params._preSecurityParam, rng, ps);
+    HomAES const &heAes(ds.hePk().heAes());
+    double tablesMB = heAes.getTables().bytes() / 1048576.0;
+    long users = heAes.getTablesUsers();
+    std::cout << "HomAES constants: " << tablesMB << " MB, shared by "
+              << users << " HomAES objects ("
+              << users * tablesMB << " MB if copied)" << std::endl;
+}
+
+// Compares the full and the minimal sets of key-switching matrices.
+void keySetInfo(HeAesCmac::SecurityParams const &params) {
+    helib::Context context(HeAesCmac::KeyPair::genContext(params));
+    CryptoPP::ThreadUserTimer timer;
+    long fullBytes = 0;
+    for (bool minimalKeys : {false, true}) {
+        timer.StartTimer();
+        HeAesCmac::KeyPair keys(HeAesCmac::KeyPair::genKeyPair(context, params.hwsk, minimalKeys));
+        double seconds = timer.ElapsedTimeAsDouble();
+        long bytes = keys.pk().keySwitchingBytes();
+        std::cout << (minimalKeys ? "minimal" : "full") << " key set: "
+                  << keys.pk().keySwitchingMatrices() << " matrices, "
+                  << bytes / 1048576.0 << " MB, generated in "
+                  << seconds << " seconds" << std::endl;
+        if (minimalKeys) {
+            std::cout << "saved: " << (fullBytes - bytes) / 1048576.0 << " MB" << std::endl;
+        } else {
+            fullBytes = bytes;
+        }
+    }
+}
+
+// Saves the HE state of the services, and measures how long restoring it
+// takes compared to generating it.
+void persistenceInfo(ExperimentParams const &params) {
+    CryptoPP::AutoSeededRandomPool rng;
+    CryptoPP::ThreadUserTimer timer;
+
+    timer.StartTimer();
+    muse::PrivacyService ps(rng, params._heSecurityParams);
+    muse::DataStorageService ds(params._preSecurityParam, params._preSecurityParam,
+                                params._preSecurityParam, rng, ps);
+    std::cout << "Generated services in " << timer.ElapsedTimeAsDouble()
+              << " seconds." << std::endl;
+    {
+        std::ofstream psOut("ps.bin", std::ios::binary);
+        ps.write(psOut);
+        std::ofstream dsOut("ds_hash_key.bin", std::ios::binary);
+        ds.writeHashKey(dsOut);
+    }
+
+    timer.StartTimer();
+    std::ifstream psIn("ps.bin", std::ios::binary);
+    muse::PrivacyService loadedPs(psIn);
+    std::ifstream dsIn("ds_hash_key.bin", std::ios::binary);
+    muse::DataStorageService loadedDs(params._preSecurityParam, params._preSecurityParam,
+                                      params._preSecurityParam, dsIn, loadedPs);
+    std::cout << "Loaded services in " << timer.ElapsedTimeAsDouble()
+              << " seconds." << std::endl;
+}
+
+// Stores documents in a disk-backed DSS, then opens the storage again with
+// a new DSS, which finds them without re-ingesting.
+void storageInfo(ExperimentParams const &params) {
+    CryptoPP::AutoSeededRandomPool rng;
+    CryptoPP::ThreadUserTimer timer;
+    std::string const directory("dss_storage");
+    std::string content(params._documentSize, UCHAR_MAX);
+    CryptoPP::Integer document(content.c_str());
+
+    muse::PrivacyService ps(rng, params._heSecurityParams);
+    {
+        muse::DataStorageService ds(params._preSecurityParam, params._preSecurityParam,
+                                    params._preSecurityParam, rng, ps);
+        ds.openStorage(directory);
+        std::ofstream dsOut(directory + "/hash_key.bin", std::ios::binary);
+        ds.writeHashKey(dsOut);
+        muse::Client client(0, params._searchKeySize, ds);
+        for (size_t i = 0; i != params._totalDocuments; ++i) {
+            client.store({intToStringOfSize(i, params._searchKeySize)}, document);
+        }
+        timer.StartTimer();
+        ds.checkpoint();
+        std::cout << "Checkpointed " << ds.documentCount() << " documents in "
+                  << timer.ElapsedTimeAsDouble() << " seconds." << std::endl;
+    }
+
+    timer.StartTimer();
+    std::ifstream dsIn(directory + "/hash_key.bin", std::ios::binary);
+    muse::DataStorageService ds(params._preSecurityParam, params._preSecurityParam,
+                                params._preSecurityParam, dsIn, ps);
+    ds.openStorage(directory);
+    std::cout << "Reopened " << ds.documentCount() << " documents in "
+              << timer.ElapsedTimeAsDouble() << " seconds." << std::endl;
+}
+
+void tuneParams(size_t maxSearchKeySize, double securityLevel, bool bootstrap) {
+    CryptoPP::AutoSeededRandomPool rng;
+    HeAesCmac::ParamTuner tuner(maxSearchKeySize, securityLevel, bootstrap);
+    HeAesCmac::TuningResult result(tuner.tune(rng, &std::cout));
+    HeAesCmac::SecurityParams const &params(result.params);
+    std::cout << "Fastest valid parameters: m=" << params.m
+              << " k=" << params.k << " c=" << params.c
+              << " hwsk=" << params.hwsk
+              << " bootstrap=" << params.bootstrap << std::endl;
+    std::cout << "security: " << result.security
+              << ", slots: " << result.slots
+              << ", capacity used: " << result.capacityUsed << " bits"
+              << ", CMAC time: " << result.seconds << " seconds" << std::endl;
 }
 
 int main() {
     viewContextInfo(baseSetup()._heSecurityParams);
+    //viewMemoryInfo(baseSetup());
+    //keySetInfo(baseSetup()._heSecurityParams);
+    //persistenceInfo(baseSetup());
+    //storageInfo(baseSetup());
     //searchKeySizeExperiment();
     //documentSizeExperiment();
     //searchKeysPerDocumentExperiment();
     //totalDocumentsExperiment();
     //documentsPerSearchKeyExperiment();
+    //threadScalingExperiment();
+    //bootstrapSearchKeySizeExperiment();
+    //sBoxExperiment();
+    //transcipherExperiment();
+    //searchKeyCacheExperiment();
+    //hashPipelineExperiment();
+    //concurrentClientsExperiment();
+    //reencryptionCacheExperiment();
+    //tuneParams(16, 128, false);
 }
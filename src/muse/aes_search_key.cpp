@@ -0,0 +1,16 @@
+#include "muse/aes_search_key.h"
+
+namespace muse {
+    AesSearchKey::AesSearchKey(std::vector<CryptoPP::byte> const &blocks, bool padded):
+        _blocks(blocks),
+        _padded(padded)
+    {}
+
+    std::vector<CryptoPP::byte> const &AesSearchKey::blocks() const {
+        return _blocks;
+    }
+
+    bool AesSearchKey::isPadded() const {
+        return _padded;
+    }
+}
\ No newline at end of file
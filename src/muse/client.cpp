@@ -1,14 +1,24 @@
 #include "muse/client.h"
 
+#include "cryptopp/aes.h"
+#include "cryptopp/modes.h"
+
 namespace muse {
 
+    size_t const Client::ZERO_POOL_SIZE;
+
     Client::Client(size_t id, size_t searchKeyLength, DataStorageService &ds):
         _id(id),
         _searchKeyLength(searchKeyLength),
         _preKeys(ds.preScheme().keyGen()),
-        _ds(ds)
+        _ds(ds),
+        _rerandomize(false)
     {}
 
+    Client::~Client() {
+        stopZeroPool();
+    }
+
     pre::PublicKey const &Client::prePk() const {
         return _preKeys.pk();
     }
@@ -21,19 +31,68 @@ namespace muse {
         _ds.revokeAccess(_id, toId);
     }
 
+    void Client::useTranscipher(std::vector<CryptoPP::byte> const &aesKey) {
+        std::vector<helib::Ctxt> aesKeyCtxt;
+        _ds.hePk().encryptAesKey(aesKey, aesKeyCtxt);
+        _ds.registerTranscipherKey(_id, aesKeyCtxt);
+        _aesKey = aesKey;
+    }
+
+    void Client::setSearchKeyCache(size_t capacity, bool rerandomize) {
+        _searchKeyCache.setCapacity(capacity);
+        _rerandomize = rerandomize;
+        if (!rerandomize || capacity == 0) {
+            stopZeroPool();
+        } else if (!_zeros) {
+            _zeros.reset(new BoundedQueue<helib::Ctxt>(ZERO_POOL_SIZE));
+            _zeroEncrypter = std::thread(&Client::encryptZeros, this);
+        }
+    }
+
+    SearchKeyCache const &Client::searchKeyCache() const {
+        return _searchKeyCache;
+    }
+
     void Client::store(std::vector<std::string> const &searchKeys, CryptoPP::Integer const &data) {
+        pre::PrimaryCtxt encryptedData(_ds.preScheme().encrypt(data, _preKeys.pk()));
+        if (!_aesKey.empty()) {
+            std::vector<AesSearchKey> encryptedKeys;
+            encryptedKeys.reserve(searchKeys.size());
+            for (auto key : searchKeys) {
+                encryptedKeys.emplace_back(aesEncryptSearchKey(key));
+            }
+            _ds.store(_id, encryptedKeys, encryptedData);
+            return;
+        }
         std::vector<SearchKeyCtxt> encryptedKeys;
         encryptedKeys.reserve(searchKeys.size());
         for (auto key : searchKeys) {
-            encryptedKeys.emplace_back(encryptSearchKey(key));
+            encryptedKeys.emplace_back(cachedSearchKey(key));
         }
-        pre::PrimaryCtxt encryptedData(_ds.preScheme().encrypt(data, _preKeys.pk()));
         _ds.store(_id, encryptedKeys, encryptedData);
     }
 
+    std::future<void> Client::storeAsync(std::vector<std::string> const &searchKeys,
+                                         CryptoPP::Integer const &data) {
+        if (!_aesKey.empty()) {
+            std::promise<void> stored;
+            store(searchKeys, data);
+            stored.set_value();
+            return stored.get_future();
+        }
+        pre::PrimaryCtxt encryptedData(_ds.preScheme().encrypt(data, _preKeys.pk()));
+        std::vector<SearchKeyCtxt> encryptedKeys;
+        encryptedKeys.reserve(searchKeys.size());
+        for (auto key : searchKeys) {
+            encryptedKeys.emplace_back(cachedSearchKey(key));
+        }
+        return _ds.storeAsync(_id, encryptedKeys, encryptedData);
+    }
+
     std::vector<CryptoPP::Integer> Client::search(std::string const &searchKey) {
-        SearchKeyCtxt searchKeyCtxt(encryptSearchKey(searchKey));
-        auto encryptedResult(_ds.search(_id, searchKeyCtxt));
+        auto encryptedResult(_aesKey.empty() ?
+                             _ds.search(_id, cachedSearchKey(searchKey)) :
+                             _ds.search(_id, aesEncryptSearchKey(searchKey)));
         std::vector<CryptoPP::Integer> result;
         result.reserve(encryptedResult.size());
         for (auto &ctxt : encryptedResult) {
@@ -48,4 +107,68 @@ namespace muse {
         _ds.hePk().encryptBlocks(ptxtBytes, ctxt);
         return SearchKeyCtxt(ctxt, ptxt.size() % CryptoPP::AES::BLOCKSIZE);
     }
+
+    SearchKeyCtxt Client::cachedSearchKey(std::string const &ptxt) {
+        if (_searchKeyCache.capacity() == 0) {
+            return encryptSearchKey(ptxt);
+        }
+        SearchKeyCtxt const *cached(_searchKeyCache.find(ptxt));
+        if (!cached) {
+            SearchKeyCtxt ctxt(encryptSearchKey(ptxt));
+            _searchKeyCache.insert(ptxt, ctxt);
+            return ctxt;
+        }
+        if (!_rerandomize) {
+            return *cached;
+        }
+        std::vector<helib::Ctxt> ctxt(cached->ctxt());
+        for (auto &block : ctxt) {
+            rerandomize(block);
+        }
+        return SearchKeyCtxt(ctxt, cached->isPadded());
+    }
+
+    // Takes an encryption of zero from the pool, or makes one if it is empty.
+    void Client::rerandomize(helib::Ctxt &ctxt) {
+        helib::Ctxt zero(_ds.hePk().pk());
+        if (_zeros && _zeros->tryPop(zero)) {
+            ctxt += zero;
+        } else {
+            _ds.hePk().rerandomize(ctxt);
+        }
+    }
+
+    // Keeps the pool full until it is closed.
+    void Client::encryptZeros() {
+        bool open = true;
+        while (open) {
+            helib::Ctxt zero(_ds.hePk().pk());
+            _ds.hePk().encryptZero(zero);
+            open = _zeros->push(std::move(zero));
+        }
+    }
+
+    void Client::stopZeroPool() {
+        if (_zeros) {
+            _zeros->close();
+            _zeroEncrypter.join();
+            _zeros.reset();
+        }
+    }
+
+    // Pads the search key like HeAesCmac::PublicKey::encryptBlocks, then
+    // encrypts it with AES-ECB. ECB reveals equal search keys of the client,
+    // which the DSS learns anyway from their hashes.
+    AesSearchKey Client::aesEncryptSearchKey(std::string const &ptxt) const {
+        std::vector<CryptoPP::byte> blocks(ptxt.cbegin(), ptxt.cend());
+        bool padded = (blocks.size() % CryptoPP::AES::BLOCKSIZE != 0);
+        if (padded) {
+            blocks.push_back(0x80);
+            blocks.resize(blocks.size() + (CryptoPP::AES::BLOCKSIZE
+                          - blocks.size() % CryptoPP::AES::BLOCKSIZE) % CryptoPP::AES::BLOCKSIZE, 0);
+        }
+        CryptoPP::ECB_Mode<CryptoPP::AES>::Encryption aes(_aesKey.data(), _aesKey.size());
+        aes.ProcessData(blocks.data(), blocks.data(), blocks.size());
+        return AesSearchKey(blocks, padded);
+    }
 }
\ No newline at end of file
@@ -1,9 +1,22 @@
 #include "muse/data_storage_service.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "NTL/BasicThreadPool.h"
+#include "muse/file_io.h"
 #include "pre/reencrypted_ctxt.h"
 
 namespace muse {
 
+    size_t const DataStorageService::SHARDS;
+
     DataStorageService::Document::Document(size_t authId, pre::PrimaryCtxt const &ctxt):
         _authId(authId),
         _ctxt(ctxt)
@@ -15,7 +28,9 @@ namespace muse {
                                            PrivacyService const &ps):
         _hashKey(HeAesCmac::CmacKeysCtxt::genKeysCtxt(rng, ps.hePk())),
         _preScheme(preK1, preK2, preKp),
-        _ps(ps)
+        _ps(ps),
+        _grantVersion(0),
+        _nextDocumentId(0)
     {}
 
     DataStorageService::DataStorageService(size_t preK1,
@@ -24,9 +39,31 @@ namespace muse {
                                            PrivacyService const &ps):
         _hashKey(HeAesCmac::CmacKeysCtxt::genKeysCtxt(hashKey, ps.hePk())),
         _preScheme(preK1, preK2, preKp),
-        _ps(ps)
+        _ps(ps),
+        _grantVersion(0),
+        _nextDocumentId(0)
+    {}
+
+    DataStorageService::DataStorageService(size_t preK1,
+                                           size_t preK2, size_t preKp,
+                                           std::istream &hashKey,
+                                           PrivacyService const &ps):
+        _hashKey(HeAesCmac::CmacKeysCtxt::read(hashKey, ps.hePk())),
+        _preScheme(preK1, preK2, preKp),
+        _ps(ps),
+        _grantVersion(0),
+        _nextDocumentId(0)
     {}
 
+    DataStorageService::~DataStorageService() {
+        _hashPipeline.reset();  // stores the documents still being hashed
+        stopPrecomputation();
+    }
+
+    void DataStorageService::writeHashKey(std::ostream &out) const {
+        _hashKey.write(out);
+    }
+
     pre::PreScheme &DataStorageService::preScheme() {
         return _preScheme;
     }
@@ -35,23 +72,241 @@ namespace muse {
         return _ps.hePk();
     }
 
+    // With storage opened, the grant is saved before it is used, and the
+    // revocation before the grant stops being used, so a restarted DSS
+    // never grants more than this one did.
     void DataStorageService::grantAccess(size_t fromId, size_t toId, pre::ReencryptionKey const &reKey) {
-        _reKeyTable[fromId].emplace(toId, reKey);
+        {
+            std::lock_guard<std::mutex> grantLock(_grantMutex);
+            std::shared_lock<std::shared_mutex> storageLock(_storageMutex);
+            if (_grantLog) {
+                _grantLog->grant(fromId, toId, reKey);
+            }
+            addGrant(fromId, toId, reKey);
+        }
+        if (_grantJobs) {
+            _grantJobs->push({fromId, toId});
+        }
     }
 
     void DataStorageService::revokeAccess(size_t fromId, size_t toId) {
-        _reKeyTable[fromId].erase(toId);
+        {
+            std::lock_guard<std::mutex> grantLock(_grantMutex);
+            std::shared_lock<std::shared_mutex> storageLock(_storageMutex);
+            if (_grantLog) {
+                _grantLog->revoke(fromId, toId);
+            }
+            removeGrant(fromId, toId);
+        }
+        _reencryptionCache.invalidate(fromId, toId);
+    }
+
+    void DataStorageService::addGrant(size_t fromId, size_t toId,
+                                      pre::ReencryptionKey const &reKey) {
+        std::shared_ptr<Grant const> grant(new Grant{reKey, ++_grantVersion});
+        {
+            ReKeyShard &shard(_reKeyShards[fromId % SHARDS]);
+            std::unique_lock<std::shared_mutex> lock(shard._mutex);
+            shard._reKeyTable[fromId][toId] = grant;
+        }
+        {
+            GrantorShard &shard(_grantorShards[toId % SHARDS]);
+            std::unique_lock<std::shared_mutex> lock(shard._mutex);
+            shard._grantors[toId].insert(fromId);
+        }
+    }
+
+    void DataStorageService::removeGrant(size_t fromId, size_t toId) {
+        {
+            ReKeyShard &shard(_reKeyShards[fromId % SHARDS]);
+            std::unique_lock<std::shared_mutex> lock(shard._mutex);
+            auto it(shard._reKeyTable.find(fromId));
+            if (it != shard._reKeyTable.end()) {
+                it->second.erase(toId);
+            }
+        }
+        {
+            GrantorShard &shard(_grantorShards[toId % SHARDS]);
+            std::unique_lock<std::shared_mutex> lock(shard._mutex);
+            auto it(shard._grantors.find(toId));
+            if (it != shard._grantors.end()) {
+                it->second.erase(fromId);
+            }
+        }
+    }
+
+    void DataStorageService::setReencryptionCache(size_t capacity, bool precomputeOnGrant) {
+        _reencryptionCache.setCapacity(capacity);
+        if (!precomputeOnGrant || capacity == 0) {
+            stopPrecomputation();
+        } else if (!_grantJobs) {
+            _grantJobs.reset(new BoundedQueue<std::pair<size_t, size_t>>(
+                std::numeric_limits<size_t>::max()));
+            _precomputer = std::thread(&DataStorageService::precompute, this);
+        }
+    }
+
+    ReencryptionCache const &DataStorageService::reencryptionCache() const {
+        return _reencryptionCache;
+    }
+
+    void DataStorageService::registerTranscipherKey(size_t clientId,
+                                                    std::vector<helib::Ctxt> const &aesKey) {
+        std::unique_lock<std::shared_mutex> lock(_transcipherMutex);
+        _transcipherKeys.erase(clientId);
+        _transcipherKeys.emplace(clientId, aesKey);
+    }
+
+    void DataStorageService::openStorage(std::string const &directory) {
+        std::lock_guard<std::mutex> grantLock(_grantMutex);
+        std::unique_lock<std::shared_mutex> lock(_storageMutex);
+        if (!_documentStore && _nextDocumentId != 0) {
+            throw std::logic_error("Documents are already stored in memory.");
+        }
+        _documentStore.reset(new DocumentStore(directory));
+        for (auto &indexShard : _indexShards) {
+            indexShard._index = InvertedIndex();
+        }
+        _frozenIndex.reset();
+        std::string const indexPath(directory + "/index.dat");
+        if (::access(indexPath.c_str(), F_OK) == 0) {
+            try {
+                _frozenIndex.reset(new FrozenIndex(indexPath));
+            } catch (std::runtime_error const &) {
+                // saved in an older format, or damaged: the index only
+                // speeds up opening, so it is dropped and all the records
+                // are indexed again
+                if (std::remove(indexPath.c_str()) != 0) {
+                    throw std::runtime_error("Cannot remove " + indexPath);
+                }
+                syncPath(directory);
+            }
+        }
+        // documents stored after the last checkpoint are indexed again from
+        // the digests in their records
+        size_t indexed = (_frozenIndex ? _frozenIndex->documents() : 0);
+        for (size_t documentId = indexed; documentId != _documentStore->size(); ++documentId) {
+            size_t authId = _documentStore->authId(documentId);
+            for (auto const &digest : _documentStore->digests(documentId)) {
+                Digest key(digest.forOwner(authId));
+                _indexShards[shard(key)]._index.append(key, documentId);
+            }
+        }
+
+        // the grants made before are newer than those saved for the same
+        // (owner, recipient), so they are kept, and saved in turn
+        _grantLog.reset(new GrantLog(directory + "/grants.dat"));
+        for (auto const &reKeyShard : _reKeyShards) {
+            std::shared_lock<std::shared_mutex> shardLock(reKeyShard._mutex);
+            for (auto const &owner : reKeyShard._reKeyTable) {
+                for (auto const &grant : owner.second) {
+                    _grantLog->grant(owner.first, grant.first, grant.second->_reKey);
+                }
+            }
+        }
+        for (auto const &grant : _grantLog->grants()) {
+            if (!findGrant(grant.first.first, grant.first.second)) {
+                addGrant(grant.first.first, grant.first.second, grant.second);
+            }
+        }
+        _storageDirectory = directory;
+    }
+
+    // The new index is written next to the old one and renamed over it, so
+    // a crash leaves one of the two complete.
+    void DataStorageService::checkpoint() {
+        std::unique_lock<std::shared_mutex> lock(_storageMutex);
+        if (!_documentStore) {
+            throw std::logic_error("No storage opened.");
+        }
+        _documentStore->sync();
+        InvertedIndex merged;
+        if (_frozenIndex) {
+            _frozenIndex->appendTo(merged);
+        }
+        for (auto const &indexShard : _indexShards) {
+            merged.append(indexShard._index);
+        }
+
+        std::string const indexPath(_storageDirectory + "/index.dat");
+        std::string const tmpPath(indexPath + ".tmp");
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            merged.write(out, _documentStore->size());
+            out.flush();
+            if (!out) {
+                throw std::runtime_error("Cannot write " + tmpPath);
+            }
+        }
+        // the new index is on disk before it replaces the old one, and the
+        // rename is before the checkpoint returns
+        syncPath(tmpPath);
+        if (std::rename(tmpPath.c_str(), indexPath.c_str()) != 0) {
+            throw std::runtime_error("Cannot replace " + indexPath);
+        }
+        syncPath(_storageDirectory);
+        _frozenIndex.reset(new FrozenIndex(indexPath));
+        for (auto &indexShard : _indexShards) {
+            indexShard._index = InvertedIndex();
+        }
+    }
+
+    size_t DataStorageService::documentCount() const {
+        std::shared_lock<std::shared_mutex> lock(_storageMutex);
+        return (_documentStore ? _documentStore->size() : _nextDocumentId.load());
+    }
+
+    void DataStorageService::enableHashPipeline(size_t queueCapacity, size_t psRequests) {
+        _hashPipeline.reset();
+        _hashPipeline.reset(new HashPipeline(_hashKey, _ps, queueCapacity, psRequests));
+    }
+
+    void DataStorageService::disableHashPipeline() {
+        _hashPipeline.reset();
     }
 
     void DataStorageService::store(size_t clientId,
                                    std::vector<SearchKeyCtxt> const &searchKeys,
                                    pre::PrimaryCtxt const &ctxt) {
-        Document document(clientId, ctxt);
-        for (auto key : searchKeys) {
-            std::string hash;
-            computeHash(key, hash);
-            _storage.emplace(hash, document);
+        if (_hashPipeline) {
+            storeAsync(clientId, searchKeys, ctxt).get();
+            return;
         }
+        // the proof is checked once here (or in storeAsync), and the stored
+        // copy remembers it, so re-encryptions and retrievals do not check
+        // it again
+        ctxt.validate(_preScheme);
+        std::vector<std::string> hashes;
+        computeHashes(searchKeys, hashes);
+        addDocument(clientId, ctxt, hashes);
+    }
+
+    std::future<void> DataStorageService::storeAsync(size_t clientId,
+                                                     std::vector<SearchKeyCtxt> const &searchKeys,
+                                                     pre::PrimaryCtxt const &ctxt) {
+        if (!_hashPipeline) {
+            std::promise<void> stored;
+            store(clientId, searchKeys, ctxt);
+            stored.set_value();
+            return stored.get_future();
+        }
+        ctxt.validate(_preScheme);
+
+        // the pipeline thread that gets the last hash adds the document, so
+        // it is stored whether or not the future is waited on. The pipeline
+        // runs its callbacks before it is destroyed, which this object
+        // outlives.
+        std::shared_ptr<std::promise<void>> stored(new std::promise<void>);
+        std::future<void> result(stored->get_future());
+        _hashPipeline->submit(searchKeys,
+            [this, clientId, ctxt, stored](std::vector<std::string> const &hashes) {
+                addDocument(clientId, ctxt, hashes);
+                stored->set_value();
+            },
+            [stored](std::exception_ptr error) {
+                stored->set_exception(error);
+            });
+        return result;
     }
 
     std::vector<std::unique_ptr<pre::Ctxt>>
@@ -59,28 +314,320 @@ namespace muse {
         std::string hash;
         std::vector<std::unique_ptr<pre::Ctxt>> result;
         computeHash(searchKey, hash);
-        auto range(_storage.equal_range(hash));
-        for (auto it = range.first; it != range.second; ++it) {
-            if (it->second._authId == clientId) {
-                result.emplace_back(new pre::PrimaryCtxt(it->second._ctxt));
+        Digest digest(Digest::fromString(hash));
+
+        // only the posting lists of the client and of the owners that
+        // granted it access are read, each grant is looked up once
+        std::vector<size_t> owners(grantors(clientId));
+        owners.erase(std::remove(owners.begin(), owners.end(), clientId), owners.end());
+        owners.push_back(clientId);
+        std::vector<std::shared_ptr<Grant const>> grants(owners.size());
+        std::vector<std::pair<size_t, size_t>> hits;    // (document, owner index)
+        std::shared_lock<std::shared_mutex> lock(_storageMutex);
+        for (size_t i = 0; i != owners.size(); ++i) {
+            if (owners[i] != clientId) {
+                grants[i] = findGrant(owners[i], clientId);
+                if (!grants[i]) {
+                    continue;   // revoked meanwhile
+                }
+            }
+            for (size_t documentId : documentIds(digest.forOwner(owners[i]))) {
+                hits.emplace_back(documentId, i);
+            }
+        }
+        // in the order the documents were stored, as with a single list
+        std::sort(hits.begin(), hits.end());
+
+        // the re-encryptions are independent, so they run on the pool, each
+        // into the position of its hit
+        result.resize(hits.size());
+        _ps.hePk().useThreads();
+        NTL_EXEC_RANGE(long(hits.size()), first, last)
+        for (long i = first; i != last; ++i) {
+            auto const &hit(hits[i]);
+            std::unique_ptr<pre::PrimaryCtxt> loaded;
+            if (!grants[hit.second]) {
+                result[i].reset(new pre::PrimaryCtxt(documentCtxt(hit.first, loaded)));
             } else {
-                auto reKeyIt(_reKeyTable[it->second._authId].find(clientId));
-                if (reKeyIt != _reKeyTable[it->second._authId].end()) {
-                    result.emplace_back(
-                        new pre::ReencryptedCtxt(
-                            _preScheme.reencrypt(it->second._ctxt, reKeyIt->second)
-                        )
-                    );
+                result[i].reset(
+                    new pre::ReencryptedCtxt(
+                        *reencrypt(hit.first, owners[hit.second], clientId,
+                                   *grants[hit.second], loaded)
+                    )
+                );
+            }
+        }
+        NTL_EXEC_RANGE_END
+        return result;
+    }
+
+    void DataStorageService::store(size_t clientId,
+                                   std::vector<AesSearchKey> const &searchKeys,
+                                   pre::PrimaryCtxt const &ctxt) {
+        std::vector<SearchKeyCtxt> searchKeysCtxt;
+        transcipher(clientId, searchKeys, searchKeysCtxt);
+        store(clientId, searchKeysCtxt, ctxt);
+    }
+
+    std::vector<std::unique_ptr<pre::Ctxt>>
+        DataStorageService::search(size_t clientId, AesSearchKey const &searchKey) {
+        std::vector<SearchKeyCtxt> searchKeyCtxt;
+        transcipher(clientId, {searchKey}, searchKeyCtxt);
+        return search(clientId, searchKeyCtxt.front());
+    }
+
+    size_t DataStorageService::shard(Digest const &digest) {
+        return digest.hash() % SHARDS;
+    }
+
+    // The document is stored once, and each of its search keys indexes it by
+    // ID in the posting list of the key for the client. It is added before
+    // the index entries, so a concurrent search finds every document it gets
+    // the ID of.
+    void DataStorageService::addDocument(size_t clientId, pre::PrimaryCtxt const &ctxt,
+                                         std::vector<std::string> const &hashes) {
+        std::array<std::vector<Digest>, SHARDS> digests;
+        std::vector<Digest> allDigests;
+        allDigests.reserve(hashes.size());
+        for (auto const &hash : hashes) {
+            Digest digest(Digest::fromString(hash));
+            Digest key(digest.forOwner(clientId));
+            digests[shard(key)].push_back(key);
+            allDigests.push_back(digest);
+        }
+
+        std::shared_lock<std::shared_mutex> storageLock(_storageMutex);
+        size_t documentId;
+        if (_documentStore) {
+            documentId = _documentStore->append(clientId, allDigests, ctxt);
+        } else {
+            documentId = _nextDocumentId++;
+            DocumentShard &documentShard(_documentShards[documentId % SHARDS]);
+            std::unique_lock<std::shared_mutex> lock(documentShard._mutex);
+            documentShard._documents.emplace(documentId, Document(clientId, ctxt));
+        }
+        for (size_t i = 0; i != SHARDS; ++i) {
+            if (!digests[i].empty()) {
+                std::unique_lock<std::shared_mutex> lock(_indexShards[i]._mutex);
+                _indexShards[i]._index.append(digests[i], documentId);
+            }
+        }
+    }
+
+    std::shared_ptr<DataStorageService::Grant const>
+        DataStorageService::findGrant(size_t fromId, size_t toId) const {
+        ReKeyShard const &shard(_reKeyShards[fromId % SHARDS]);
+        std::shared_lock<std::shared_mutex> lock(shard._mutex);
+        auto it(shard._reKeyTable.find(fromId));
+        if (it == shard._reKeyTable.end()) {
+            return nullptr;
+        }
+        auto grantIt(it->second.find(toId));
+        if (grantIt == it->second.end()) {
+            return nullptr;
+        }
+        return grantIt->second;
+    }
+
+    // The caller holds _storageMutex. Safe to call from several threads.
+    std::shared_ptr<pre::ReencryptedCtxt const>
+        DataStorageService::reencrypt(size_t documentId, size_t ownerId, size_t recipientId,
+                                      Grant const &grant,
+                                      std::unique_ptr<pre::PrimaryCtxt> &loaded) {
+        std::shared_ptr<pre::ReencryptedCtxt const> result(
+            _reencryptionCache.find(documentId, recipientId, grant._version));
+        if (!result) {
+            result = std::make_shared<pre::ReencryptedCtxt const>(
+                _preScheme.reencrypt(documentCtxt(documentId, loaded), grant._reKey));
+            _reencryptionCache.insert(documentId, recipientId, ownerId, grant._version, result);
+        }
+        return result;
+    }
+
+    std::vector<size_t> DataStorageService::grantors(size_t recipientId) const {
+        GrantorShard const &shard(_grantorShards[recipientId % SHARDS]);
+        std::shared_lock<std::shared_mutex> lock(shard._mutex);
+        auto it(shard._grantors.find(recipientId));
+        if (it == shard._grantors.end()) {
+            return {};
+        }
+        return std::vector<size_t>(it->second.cbegin(), it->second.cend());
+    }
+
+    // A scan of the owners of all the documents; the caller holds
+    // _storageMutex.
+    std::vector<size_t> DataStorageService::ownedDocuments(size_t ownerId) const {
+        std::vector<size_t> result;
+        if (_documentStore) {
+            for (size_t documentId = 0; documentId != _documentStore->size(); ++documentId) {
+                if (_documentStore->authId(documentId) == ownerId) {
+                    result.push_back(documentId);
+                }
+            }
+            return result;
+        }
+        for (auto const &documentShard : _documentShards) {
+            std::shared_lock<std::shared_mutex> lock(documentShard._mutex);
+            for (auto const &document : documentShard._documents) {
+                if (document.second._authId == ownerId) {
+                    result.push_back(document.first);
                 }
             }
         }
+        std::sort(result.begin(), result.end());
         return result;
     }
 
+    // Re-encrypts the documents of each new grant into the cache, newest
+    // first as they are the likeliest to be searched, up to a quarter of
+    // its capacity; the documents already cached do not count. The storage
+    // lock is taken per document, not to hold up a checkpoint.
+    void DataStorageService::precompute() {
+        std::pair<size_t, size_t> job;
+        while (_grantJobs->pop(job)) {
+            std::vector<size_t> documents;
+            {
+                std::shared_lock<std::shared_mutex> storageLock(_storageMutex);
+                documents = ownedDocuments(job.first);
+            }
+            size_t budget = std::max<size_t>(_reencryptionCache.capacity() / 4, 1);
+            for (auto it = documents.crbegin(); it != documents.crend() && budget != 0; ++it) {
+                std::shared_ptr<Grant const> grant(findGrant(job.first, job.second));
+                if (!grant) {
+                    break;  // revoked meanwhile
+                }
+                std::shared_lock<std::shared_mutex> storageLock(_storageMutex);
+                if (!_reencryptionCache.contains(*it, job.second, grant->_version)) {
+                    std::unique_ptr<pre::PrimaryCtxt> loaded;
+                    _reencryptionCache.insert(*it, job.second, job.first, grant->_version,
+                        std::make_shared<pre::ReencryptedCtxt const>(
+                            _preScheme.reencrypt(documentCtxt(*it, loaded), grant->_reKey)));
+                    --budget;
+                }
+            }
+        }
+    }
+
+    void DataStorageService::stopPrecomputation() {
+        if (_grantJobs) {
+            _grantJobs->close();
+            _precomputer.join();
+            _grantJobs.reset();
+        }
+    }
+
+    // The IDs in the saved index are all below those added since. The
+    // caller holds _storageMutex.
+    std::vector<size_t> DataStorageService::documentIds(Digest const &digest) const {
+        std::vector<size_t> result;
+        if (_frozenIndex) {
+            auto range(_frozenIndex->postings(digest));
+            result.assign(range.first, range.second);
+        }
+        IndexShard const &indexShard(_indexShards[shard(digest)]);
+        std::shared_lock<std::shared_mutex> lock(indexShard._mutex);
+        std::vector<size_t> const &recent(indexShard._index.postings(digest));
+        result.insert(result.end(), recent.cbegin(), recent.cend());
+        return result;
+    }
+
+    // Reads the ciphertext into loaded if it is on disk. Documents are never
+    // removed, and the nodes of an unordered_map do not move, so the
+    // reference outlives the lock.
+    pre::PrimaryCtxt const &DataStorageService::documentCtxt(
+        size_t documentId, std::unique_ptr<pre::PrimaryCtxt> &loaded) const {
+        if (_documentStore) {
+            if (!loaded) {
+                loaded.reset(new pre::PrimaryCtxt(_documentStore->read(documentId)));
+            }
+            return *loaded;
+        }
+        DocumentShard const &documentShard(_documentShards[documentId % SHARDS]);
+        std::shared_lock<std::shared_mutex> lock(documentShard._mutex);
+        return documentShard._documents.at(documentId)._ctxt;
+    }
+
     void DataStorageService::computeHash(SearchKeyCtxt const &input,
                                          std::string &output) const {
+        if (_hashPipeline) {
+            output = _hashPipeline->submit(input).get();
+            return;
+        }
         helib::Ctxt hashCtxt(_ps.hePk().pk());
         _ps.hePk().heAesCmac(_hashKey, input.ctxt(), input.isPadded(), hashCtxt);
-        _ps.computeHash(hashCtxt, output);
+        requestHash(hashCtxt, output);
+    }
+
+    void DataStorageService::computeHashes(std::vector<SearchKeyCtxt> const &input,
+                                           std::vector<std::string> &output) const {
+        std::vector<std::vector<helib::Ctxt>> blocks;
+        std::vector<bool> padded;
+        blocks.reserve(input.size());
+        padded.reserve(input.size());
+        for (auto const &key : input) {
+            blocks.push_back(key.ctxt());
+            padded.push_back(key.isPadded());
+        }
+        std::vector<helib::Ctxt> hashCtxt;
+        _ps.hePk().heAesCmacPacked(_hashKey, blocks, padded, hashCtxt);
+
+        // the CMACs stay packed, and the PS hashes a whole ciphertext of them
+        // per request (heAesCmacPacked zeroes the lanes without a search
+        // key, so it sees nothing else); the requests are independent, so
+        // they run on the pool
+        size_t nLanes = _ps.hePk().lanes();
+        std::vector<std::vector<std::string>> packedHashes(hashCtxt.size());
+        _ps.hePk().useThreads();
+        NTL_EXEC_RANGE(long(hashCtxt.size()), first, last)
+        for (long i = first; i != last; ++i) {
+            size_t count = std::min(nLanes, input.size() - i * nLanes);
+            _ps.computeHashBatch(_ps.hePk().serializeForDecryption(hashCtxt[i]),
+                                 count, packedHashes[i]);
+        }
+        NTL_EXEC_RANGE_END
+
+        output.clear();
+        output.reserve(input.size());
+        for (auto &hashes : packedHashes) {
+            std::move(hashes.begin(), hashes.end(), std::back_inserter(output));
+        }
+    }
+
+    // Sends the CMAC to the PS at the lowest level it decrypts at.
+    void DataStorageService::requestHash(helib::Ctxt &hashCtxt, std::string &output) const {
+        _ps.computeHash(_ps.hePk().serializeForDecryption(hashCtxt), output);
+    }
+
+    // The blocks of all the keys are transciphered together, so they share
+    // the packed homomorphic AES decryption.
+    void DataStorageService::transcipher(size_t clientId,
+                                         std::vector<AesSearchKey> const &input,
+                                         std::vector<SearchKeyCtxt> &output) const {
+        std::shared_lock<std::shared_mutex> lock(_transcipherMutex);
+        auto keyIt(_transcipherKeys.find(clientId));
+        if (keyIt == _transcipherKeys.end()) {
+            throw std::invalid_argument("No transciphering key registered for the client.");
+        }
+
+        // each key is split off the transciphered blocks by its own size,
+        // so a ragged one would shift the blocks of the next ones
+        std::vector<CryptoPP::byte> blocks;
+        for (auto const &key : input) {
+            if (key.blocks().empty() || key.blocks().size() % CryptoPP::AES::BLOCKSIZE != 0) {
+                throw std::invalid_argument("AES search key is not a whole number of blocks.");
+            }
+            blocks.insert(blocks.end(), key.blocks().cbegin(), key.blocks().cend());
+        }
+        std::vector<helib::Ctxt> blocksCtxt;
+        _ps.hePk().transcipherBlocks(keyIt->second, blocks, blocksCtxt);
+
+        output.clear();
+        output.reserve(input.size());
+        auto blockIt(blocksCtxt.cbegin());
+        for (auto const &key : input) {
+            auto nextIt(std::next(blockIt, key.blocks().size() / CryptoPP::AES::BLOCKSIZE));
+            output.emplace_back(std::vector<helib::Ctxt>(blockIt, nextIt), key.isPadded());
+            blockIt = nextIt;
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include "muse/document_store.h"
+
+#include <cerrno>
+#include <cstring>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "muse/file_io.h"
+#include "pre/integer_io.h"
+
+namespace muse {
+
+    namespace {
+        // Reads a PrimaryCtxt straight from the mapped record.
+        struct MemoryBuffer : std::streambuf {
+            MemoryBuffer(char const *begin, char const *end) {
+                setg(const_cast<char *>(begin), const_cast<char *>(begin), const_cast<char *>(end));
+            }
+        };
+
+        uint64_t loadUint64(char const *data) {
+            uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        std::runtime_error systemError(std::string const &what, std::string const &path) {
+            return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+        }
+
+        // The size field, the checksum of the rest of the record, then the
+        // owner and the number of digests.
+        size_t const HEADER_BYTES = 4 * sizeof(uint64_t);
+    }
+
+    uint64_t const DocumentStore::DEFAULT_SEGMENT_BYTES;
+
+    DocumentStore::DocumentStore(std::string const &directory, uint64_t segmentBytes):
+        _directory(directory),
+        _segmentBytes(segmentBytes),
+        _fd(-1),
+        _activeSize(0)
+    {
+        if (::mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw systemError("Cannot create", _directory);
+        }
+        size_t segments = 0;
+        while (::access(segmentPath(segments).c_str(), F_OK) == 0) {
+            ++segments;
+        }
+        for (size_t segment = 0; segment != segments; ++segment) {
+            _activeSize = scanSegment(segment, segment + 1 == segments);
+        }
+        openSegment(segments == 0 ? 0 : segments - 1);
+    }
+
+    DocumentStore::~DocumentStore() {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+    size_t DocumentStore::append(size_t authId, std::vector<Digest> const &digests,
+                                 pre::PrimaryCtxt const &ctxt) {
+        if (!ctxt.isValidated()) {
+            throw std::invalid_argument("Only validated ciphertexts are stored.");
+        }
+        std::ostringstream out;
+        pre::writeUint64(out, 0);
+        pre::writeUint64(out, 0);
+        pre::writeUint64(out, authId);
+        pre::writeUint64(out, digests.size());
+        for (auto const &digest : digests) {
+            out.write(reinterpret_cast<char const *>(digest._bytes.data()), Digest::SIZE);
+        }
+        ctxt.write(out);
+        std::string data(out.str());
+        uint64_t size = data.size() - sizeof(uint64_t);
+        std::memcpy(&data[0], &size, sizeof(size));
+        uint64_t checksum = recordChecksum(data.data() + 2 * sizeof(uint64_t),
+                                           data.size() - 2 * sizeof(uint64_t));
+        std::memcpy(&data[sizeof(uint64_t)], &checksum, sizeof(checksum));
+
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        if (_activeSize != 0 && _activeSize + data.size() > _segmentBytes) {
+            openSegment(_segments.size());
+        }
+        writeRecord(_fd, data, _activeSize, segmentPath(_segments.size() - 1));
+
+        _locations.push_back({uint32_t(_segments.size() - 1), _activeSize, data.size(), authId});
+        _activeSize += data.size();
+        return _locations.size() - 1;
+    }
+
+    void DocumentStore::sync() {
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        if (::fdatasync(_fd) != 0) {
+            throw systemError("Cannot sync", segmentPath(_segments.size() - 1));
+        }
+    }
+
+    size_t DocumentStore::size() const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _locations.size();
+    }
+
+    size_t DocumentStore::authId(size_t documentId) const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        return _locations.at(documentId)._authId;
+    }
+
+    std::vector<Digest> DocumentStore::digests(size_t documentId) const {
+        std::shared_lock<std::shared_mutex> lock(lockRecord(documentId));
+        uint64_t size;
+        char const *data = record(documentId, size);
+        std::vector<Digest> result(loadUint64(data + 2 * sizeof(uint64_t)));
+        data += HEADER_BYTES - sizeof(uint64_t);
+        for (auto &digest : result) {
+            std::memcpy(digest._bytes.data(), data, Digest::SIZE);
+            data += Digest::SIZE;
+        }
+        return result;
+    }
+
+    pre::PrimaryCtxt DocumentStore::read(size_t documentId) const {
+        std::shared_lock<std::shared_mutex> lock(lockRecord(documentId));
+        uint64_t size;
+        char const *data = record(documentId, size);
+        uint64_t digestBytes = loadUint64(data + 2 * sizeof(uint64_t)) * Digest::SIZE;
+        MemoryBuffer buffer(data + HEADER_BYTES - sizeof(uint64_t) + digestBytes, data + size);
+        std::istream in(&buffer);
+        return pre::PrimaryCtxt::readValidated(in);
+    }
+
+    std::string DocumentStore::segmentPath(size_t segment) const {
+        return _directory + "/segment-" + std::to_string(segment) + ".dat";
+    }
+
+    // sync() only flushes the last segment, so the one left is flushed
+    // here, and the directory once it holds a new segment.
+    void DocumentStore::openSegment(size_t segment) {
+        if (_fd >= 0) {
+            if (::fdatasync(_fd) != 0) {
+                throw systemError("Cannot sync", segmentPath(_segments.size() - 1));
+            }
+            ::close(_fd);
+            _fd = -1;
+        }
+        std::string const path(segmentPath(segment));
+        _fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (_fd < 0) {
+            throw systemError("Cannot open", path);
+        }
+        if (segment == _segments.size()) {
+            syncPath(_directory);
+            _segments.emplace_back();
+            _activeSize = 0;
+        }
+    }
+
+    // Only the last segment can end in a record torn by a crash, as a
+    // segment is synced before the next one is started; the records of the
+    // others are checked when read.
+    uint64_t DocumentStore::scanSegment(size_t segment, bool last) {
+        std::unique_ptr<MappedFile> file(new MappedFile(segmentPath(segment)));
+        uint64_t offset = 0;
+        while (file->size() - offset >= HEADER_BYTES) {
+            char const *data = file->data() + offset;
+            uint64_t size = loadUint64(data);
+            if (size < HEADER_BYTES - sizeof(uint64_t)
+                || size > file->size() - offset - sizeof(uint64_t)
+                || (last && loadUint64(data + sizeof(uint64_t))
+                            != recordChecksum(data + 2 * sizeof(uint64_t),
+                                              size - sizeof(uint64_t)))) {
+                break;
+            }
+            _locations.push_back({uint32_t(segment), offset, sizeof(uint64_t) + size,
+                                  size_t(loadUint64(data + 2 * sizeof(uint64_t)))});
+            offset += sizeof(uint64_t) + size;
+        }
+        if (offset != file->size()) {
+            if (!last) {
+                throw std::runtime_error("Corrupt record at " + std::to_string(offset)
+                                         + " of " + segmentPath(segment));
+            }
+            file.reset();
+            if (::truncate(segmentPath(segment).c_str(), offset) != 0) {
+                throw systemError("Cannot truncate", segmentPath(segment));
+            }
+        }
+        _segments.push_back(std::move(file));
+        return offset;
+    }
+
+    // The last segment grows, so it is mapped again when a record is past
+    // the end of its mapping. Records only get added, so once mapped, a
+    // record stays mapped.
+    std::shared_lock<std::shared_mutex> DocumentStore::lockRecord(size_t documentId) const {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        Location location(_locations.at(documentId));
+        std::unique_ptr<MappedFile> const &file(_segments[location._segment]);
+        if (file && file->size() >= location._offset + location._size) {
+            return lock;
+        }
+        lock.unlock();
+        {
+            std::unique_lock<std::shared_mutex> exclusive(_mutex);
+            std::unique_ptr<MappedFile> &mapped(_segments[location._segment]);
+            if (!mapped) {
+                mapped.reset(new MappedFile(segmentPath(location._segment)));
+            } else if (mapped->size() < location._offset + location._size) {
+                mapped->remap();
+            }
+        }
+        lock.lock();
+        return lock;
+    }
+
+    char const *DocumentStore::record(size_t documentId, uint64_t &size) const {
+        Location const &location(_locations[documentId]);
+        size = location._size - sizeof(uint64_t);
+        char const *data = _segments[location._segment]->data() + location._offset + sizeof(uint64_t);
+        if (loadUint64(data) != recordChecksum(data + sizeof(uint64_t), size - sizeof(uint64_t))) {
+            throw std::runtime_error("Corrupt record of document " + std::to_string(documentId)
+                                     + " in " + segmentPath(location._segment));
+        }
+        return data;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "muse/file_io.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace muse {
+
+    void syncPath(std::string const &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        }
+        if (::fsync(fd) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::runtime_error("Cannot sync " + path + ": " + std::strerror(error));
+        }
+        ::close(fd);
+    }
+
+    void writeRecord(int fd, std::string const &data, uint64_t restoreSize,
+                     std::string const &path) {
+        for (size_t written = 0; written != data.size(); ) {
+            ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                int error = errno;
+                bool truncated = (::ftruncate(fd, restoreSize) == 0);
+                throw std::runtime_error((truncated ? "Cannot write " : "Cannot write nor truncate ")
+                                         + path + ": " + std::strerror(error));
+            }
+            written += n;
+        }
+    }
+
+    uint64_t recordChecksum(char const *data, size_t size) {
+        CryptoPP::CRC32C crc;
+        crc.Update(reinterpret_cast<CryptoPP::byte const *>(data), size);
+        uint32_t checksum;
+        crc.Final(reinterpret_cast<CryptoPP::byte *>(&checksum));
+        return checksum;
+    }
+
+    uint64_t ChecksumBuffer::checksum() {
+        uint32_t checksum;
+        _crc.Final(reinterpret_cast<CryptoPP::byte *>(&checksum));
+        return checksum;
+    }
+
+    std::streamsize ChecksumBuffer::xsputn(char const *data, std::streamsize size) {
+        _crc.Update(reinterpret_cast<CryptoPP::byte const *>(data), size);
+        return size;
+    }
+
+    ChecksumBuffer::int_type ChecksumBuffer::overflow(int_type c) {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            CryptoPP::byte byte = traits_type::to_char_type(c);
+            _crc.Update(&byte, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "muse/grant_log.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "muse/file_io.h"
+#include "pre/integer_io.h"
+
+namespace muse {
+
+    namespace {
+        uint64_t const REVOKE = 0;
+        uint64_t const GRANT = 1;
+
+        uint64_t loadUint64(char const *data) {
+            uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        // The size of the rest of the record, its checksum, then the payload.
+        std::string encodeRecord(std::string const &payload) {
+            std::ostringstream out;
+            pre::writeUint64(out, sizeof(uint64_t) + payload.size());
+            pre::writeUint64(out, recordChecksum(payload.data(), payload.size()));
+            out << payload;
+            return out.str();
+        }
+
+        std::string grantPayload(size_t fromId, size_t toId, pre::ReencryptionKey const &reKey) {
+            std::ostringstream out;
+            pre::writeUint64(out, GRANT);
+            pre::writeUint64(out, fromId);
+            pre::writeUint64(out, toId);
+            reKey.write(out);
+            return out.str();
+        }
+
+        std::string directoryOf(std::string const &path) {
+            size_t slash = path.rfind('/');
+            return (slash == std::string::npos ? "." : path.substr(0, slash + 1));
+        }
+    }
+
+    GrantLog::GrantLog(std::string const &path):
+        _path(path),
+        _fd(-1),
+        _size(0)
+    {
+        load();
+        compact();
+    }
+
+    GrantLog::~GrantLog() {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+    GrantLog::Grants const &GrantLog::grants() const {
+        return _grants;
+    }
+
+    void GrantLog::grant(size_t fromId, size_t toId, pre::ReencryptionKey const &reKey) {
+        append(grantPayload(fromId, toId, reKey));
+    }
+
+    void GrantLog::revoke(size_t fromId, size_t toId) {
+        std::ostringstream out;
+        pre::writeUint64(out, REVOKE);
+        pre::writeUint64(out, fromId);
+        pre::writeUint64(out, toId);
+        append(out.str());
+    }
+
+    // The records are replayed up to the first one that is incomplete or
+    // does not match its checksum.
+    void GrantLog::load() {
+        std::ifstream in(_path, std::ios::binary);
+        std::string const data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        uint64_t offset = 0;
+        while (data.size() - offset >= 2 * sizeof(uint64_t)) {
+            uint64_t size = loadUint64(data.data() + offset);
+            if (size < sizeof(uint64_t) || size > data.size() - offset - sizeof(uint64_t)) {
+                break;
+            }
+            char const *payload = data.data() + offset + 2 * sizeof(uint64_t);
+            uint64_t payloadSize = size - sizeof(uint64_t);
+            if (loadUint64(data.data() + offset + sizeof(uint64_t))
+                != recordChecksum(payload, payloadSize)) {
+                break;
+            }
+            std::istringstream record(std::string(payload, payloadSize));
+            uint64_t kind = pre::readUint64(record);
+            size_t fromId = pre::readUint64(record);
+            size_t toId = pre::readUint64(record);
+            std::pair<size_t, size_t> key(fromId, toId);
+            _grants.erase(key);
+            if (kind == GRANT) {
+                _grants.emplace(key, pre::ReencryptionKey::read(record));
+            }
+            offset += sizeof(uint64_t) + size;
+        }
+    }
+
+    // The log is written next to the old one and renamed over it, so a
+    // crash leaves one of the two complete.
+    void GrantLog::compact() {
+        std::string data;
+        for (auto const &grant : _grants) {
+            data += encodeRecord(grantPayload(grant.first.first, grant.first.second, grant.second));
+        }
+        std::string const tmpPath(_path + ".tmp");
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + tmpPath + ": " + std::strerror(errno));
+        }
+        try {
+            writeRecord(fd, data, 0, tmpPath);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        syncPath(tmpPath);
+        if (std::rename(tmpPath.c_str(), _path.c_str()) != 0) {
+            throw std::runtime_error("Cannot replace " + _path);
+        }
+        syncPath(directoryOf(_path));
+
+        _fd = ::open(_path.c_str(), O_WRONLY | O_APPEND);
+        if (_fd < 0) {
+            throw std::runtime_error("Cannot open " + _path + ": " + std::strerror(errno));
+        }
+        _size = data.size();
+    }
+
+    void GrantLog::append(std::string const &payload) {
+        std::string const data(encodeRecord(payload));
+        std::lock_guard<std::mutex> lock(_mutex);
+        writeRecord(_fd, data, _size, _path);
+        if (::fdatasync(_fd) != 0) {
+            throw std::runtime_error("Cannot sync " + _path + ": " + std::strerror(errno));
+        }
+        _size += data.size();
+    }
+}
\ No newline at end of file
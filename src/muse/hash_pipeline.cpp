@@ -0,0 +1,155 @@
+#include "muse/hash_pipeline.h"
+
+#include <stdexcept>
+
+namespace muse {
+
+    HashPipeline::Group::Group(size_t size, Done done, Failed onFailure):
+        _hashes(size),
+        _remaining(size),
+        _failed(false),
+        _done(std::move(done)),
+        _onFailure(std::move(onFailure))
+    {}
+
+    HashPipeline::HashPipeline(HeAesCmac::CmacKeysCtxt const &hashKey, PrivacyService const &ps,
+                               size_t queueCapacity, size_t consumers):
+        _hashKey(hashKey),
+        _ps(ps),
+        _jobs(queueCapacity),
+        _requests(queueCapacity)
+    {
+        _producer = std::thread(&HashPipeline::produce, this);
+        for (size_t i = 0; i != (consumers == 0 ? 1 : consumers); ++i) {
+            _consumers.emplace_back(&HashPipeline::consume, this);
+        }
+    }
+
+    HashPipeline::~HashPipeline() {
+        _jobs.close();
+        _producer.join();
+        _requests.close();
+        for (auto &consumer : _consumers) {
+            consumer.join();
+        }
+    }
+
+    void HashPipeline::submit(std::vector<SearchKeyCtxt> const &searchKeys,
+                              Done done, Failed onFailure) {
+        if (searchKeys.empty()) {
+            try {
+                done({});
+            } catch (...) {
+                onFailure(std::current_exception());
+            }
+            return;
+        }
+        std::shared_ptr<Group> group(
+            new Group(searchKeys.size(), std::move(done), std::move(onFailure)));
+        for (size_t i = 0; i != searchKeys.size(); ++i) {
+            Job job;
+            job._blocks = searchKeys[i].ctxt();
+            job._padded = searchKeys[i].isPadded();
+            job._slot = Slot{group, i};
+            if (!_jobs.push(std::move(job))) {
+                // the keys already queued still run, but the group never
+                // completes
+                group->_failed = true;
+                throw std::logic_error("The hash pipeline is shut down.");
+            }
+        }
+    }
+
+    std::future<std::string> HashPipeline::submit(SearchKeyCtxt const &searchKey) {
+        std::shared_ptr<std::promise<std::string>> hash(new std::promise<std::string>);
+        std::future<std::string> result(hash->get_future());
+        submit({searchKey},
+            [hash](std::vector<std::string> const &hashes) {
+                hash->set_value(hashes.front());
+            },
+            [hash](std::exception_ptr error) {
+                hash->set_exception(error);
+            });
+        return result;
+    }
+
+    void HashPipeline::produce() {
+        HeAesCmac::PublicKey const &hePk(_ps.hePk());
+        hePk.useThreads();
+        size_t maxBatch = hePk.lanes();
+        Job first;
+        while (_jobs.pop(first)) {
+            // take the search keys that are already waiting into the batch
+            std::vector<Job> batch;
+            batch.push_back(std::move(first));
+            Job next;
+            while (batch.size() != maxBatch && _jobs.tryPop(next)) {
+                batch.push_back(std::move(next));
+            }
+
+            std::vector<std::vector<helib::Ctxt>> blocks;
+            std::vector<bool> padded;
+            for (auto &job : batch) {
+                blocks.push_back(std::move(job._blocks));
+                padded.push_back(job._padded);
+            }
+            // the batch fits in one ciphertext, so it is one PS request; the
+            // lanes without a search key are zero
+            std::vector<helib::Ctxt> hashCtxt;
+            Request request;
+            try {
+                hePk.heAesCmacPacked(_hashKey, blocks, padded, hashCtxt);
+                request._message = hePk.serializeForDecryption(hashCtxt.front());
+            } catch (...) {
+                for (auto &job : batch) {
+                    fail(job._slot, std::current_exception());
+                }
+                continue;
+            }
+            for (auto &job : batch) {
+                request._slots.push_back(std::move(job._slot));
+            }
+            _requests.push(std::move(request));
+        }
+    }
+
+    void HashPipeline::consume() {
+        Request request;
+        while (_requests.pop(request)) {
+            std::vector<std::string> hashes;
+            try {
+                _ps.computeHashBatch(request._message, request._slots.size(), hashes);
+            } catch (...) {
+                for (auto &slot : request._slots) {
+                    fail(slot, std::current_exception());
+                }
+                continue;
+            }
+            for (size_t i = 0; i != hashes.size(); ++i) {
+                setHash(request._slots[i], hashes[i]);
+            }
+        }
+    }
+
+    // The hashes of a group are written to different elements, and the one
+    // that completes it reads them all after the others were counted.
+    void HashPipeline::setHash(Slot const &slot, std::string const &hash) {
+        Group &group(*slot._group);
+        group._hashes[slot._index] = hash;
+        if (--group._remaining != 0 || group._failed) {
+            return;
+        }
+        try {
+            group._done(group._hashes);
+        } catch (...) {
+            group._onFailure(std::current_exception());
+        }
+    }
+
+    void HashPipeline::fail(Slot const &slot, std::exception_ptr error) {
+        Group &group(*slot._group);
+        if (!group._failed.exchange(true)) {
+            group._onFailure(error);
+        }
+    }
+}
\ No newline at end of file
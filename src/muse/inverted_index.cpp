@@ -0,0 +1,333 @@
+#include "muse/inverted_index.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "muse/file_io.h"
+#include "pre/integer_io.h"
+
+namespace muse {
+
+    namespace {
+        size_t const GROUP = 16;
+        uint8_t const EMPTY = 0x80;
+        char const MAGIC[8] = {'M', 'U', 'S', 'E', 'I', 'D', 'X', '3'};
+        // The magic, the sizes, the number of documents covered and the
+        // checksum of the rest.
+        size_t const HEADER_BYTES = sizeof(MAGIC) + 5 * sizeof(uint64_t);
+
+        // Bit i of the result is set if group[i] == tag.
+        uint32_t matchGroup(uint8_t const *group, uint8_t tag) {
+#ifdef __SSE2__
+            __m128i control = _mm_loadu_si128(reinterpret_cast<__m128i const *>(group));
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(char(tag))));
+#else
+            uint32_t match = 0;
+            for (size_t i = 0; i != GROUP; ++i) {
+                if (group[i] == tag) {
+                    match |= uint32_t(1) << i;
+                }
+            }
+            return match;
+#endif
+        }
+
+        // The low 7 bits of the hash are the tag, the others pick the first
+        // group; the following groups are probed in order. Returns the slot
+        // holding key, or the first empty one if found is false.
+        size_t probe(uint8_t const *control, Digest const *keys, size_t groups,
+                     Digest const &key, uint64_t hash, bool &found) {
+            size_t mask = groups - 1;
+            uint8_t tag = hash & 0x7F;
+            for (size_t group = (hash >> 7) & mask; ; group = (group + 1) & mask) {
+                uint8_t const *groupControl = control + group * GROUP;
+                for (uint32_t match = matchGroup(groupControl, tag); match != 0; match &= match - 1) {
+                    size_t slot = group * GROUP + __builtin_ctz(match);
+                    if (keys[slot] == key) {
+                        found = true;
+                        return slot;
+                    }
+                }
+                uint32_t empty = matchGroup(groupControl, EMPTY);
+                if (empty != 0) {
+                    found = false;
+                    return group * GROUP + __builtin_ctz(empty);
+                }
+            }
+        }
+    }
+
+    size_t const Digest::SIZE;
+
+    Digest Digest::fromString(std::string const &hash) {
+        if (hash.size() != SIZE) {
+            throw std::invalid_argument("Wrong digest size.");
+        }
+        Digest digest;
+        std::memcpy(digest._bytes.data(), hash.data(), SIZE);
+        return digest;
+    }
+
+    // The ID goes through a bijective mix into the bytes used by hash(), so
+    // the lists of one search key are spread over the table.
+    Digest Digest::forOwner(uint64_t ownerId) const {
+        uint64_t mix = ownerId + 0x9E3779B97F4A7C15;
+        mix = (mix ^ (mix >> 30)) * 0xBF58476D1CE4E5B9;
+        mix = (mix ^ (mix >> 27)) * 0x94D049BB133111EB;
+        mix ^= mix >> 31;
+        uint64_t prefix = hash() ^ mix;
+        Digest result(*this);
+        std::memcpy(result._bytes.data(), &prefix, sizeof(prefix));
+        return result;
+    }
+
+    bool Digest::operator==(Digest const &other) const {
+        return _bytes == other._bytes;
+    }
+
+    uint64_t Digest::hash() const {
+        uint64_t result;
+        std::memcpy(&result, _bytes.data(), sizeof(result));
+        return result;
+    }
+
+    InvertedIndex::InvertedIndex():
+        _postingCount(0)
+    {
+        rehash(1);
+    }
+
+    void InvertedIndex::append(Digest const &key, size_t documentId) {
+        reserve(_postings.size() + 1);
+        uint64_t hash = key.hash();
+        bool found;
+        size_t slot = findSlot(key, hash, found);
+        if (!found) {
+            _control[slot] = hash & 0x7F;
+            _keys[slot] = key;
+            _lists[slot] = _postings.size();
+            _postings.emplace_back();
+        }
+        std::vector<size_t> &list(_postings[_lists[slot]]);
+        if (list.empty() || list.back() != documentId) {
+            list.push_back(documentId);
+            ++_postingCount;
+        }
+    }
+
+    void InvertedIndex::append(std::vector<Digest> const &keys, size_t documentId) {
+        reserve(_postings.size() + keys.size());
+        for (auto const &key : keys) {
+            append(key, documentId);
+        }
+    }
+
+    void InvertedIndex::append(InvertedIndex const &other) {
+        reserve(_postings.size() + other.size());
+        for (size_t slot = 0; slot != other._control.size(); ++slot) {
+            if (other._control[slot] == EMPTY) {
+                continue;
+            }
+            for (size_t documentId : other._postings[other._lists[slot]]) {
+                append(other._keys[slot], documentId);
+            }
+        }
+    }
+
+    std::vector<size_t> const &InvertedIndex::postings(Digest const &key) const {
+        static std::vector<size_t> const none;
+        bool found;
+        size_t slot = findSlot(key, key.hash(), found);
+        return found ? _postings[_lists[slot]] : none;
+    }
+
+    // The table is kept at most 7/8 full, so every probe sequence reaches an
+    // empty slot.
+    void InvertedIndex::reserve(size_t keys) {
+        size_t groups = this->groups();
+        while (groups * GROUP * 7 < keys * 8) {
+            groups *= 2;
+        }
+        if (groups != this->groups()) {
+            rehash(groups);
+        }
+    }
+
+    // The checksum goes in the header, so the body is written twice: once
+    // to compute it, then to out.
+    void InvertedIndex::write(std::ostream &out, size_t documents) const {
+        ChecksumBuffer checksum;
+        std::ostream checksummed(&checksum);
+        writeBody(checksummed);
+
+        out.write(MAGIC, sizeof(MAGIC));
+        pre::writeUint64(out, groups());
+        pre::writeUint64(out, _postings.size());
+        pre::writeUint64(out, _postingCount);
+        pre::writeUint64(out, documents);
+        pre::writeUint64(out, checksum.checksum());
+        writeBody(out);
+    }
+
+    // The slot table as it is, then the posting lists one after the other.
+    void InvertedIndex::writeBody(std::ostream &out) const {
+        out.write(reinterpret_cast<char const *>(_control.data()), _control.size());
+        out.write(reinterpret_cast<char const *>(_keys.data()), _keys.size() * sizeof(Digest));
+        for (uint32_t list : _lists) {
+            pre::writeUint64(out, list);
+        }
+        uint64_t offset = 0;
+        for (auto const &list : _postings) {
+            pre::writeUint64(out, offset);
+            offset += list.size();
+        }
+        pre::writeUint64(out, offset);
+        for (auto const &list : _postings) {
+            for (size_t documentId : list) {
+                pre::writeUint64(out, documentId);
+            }
+        }
+    }
+
+    size_t InvertedIndex::size() const {
+        return _postings.size();
+    }
+
+    size_t InvertedIndex::postingCount() const {
+        return _postingCount;
+    }
+
+    size_t InvertedIndex::memoryBytes() const {
+        size_t bytes = _control.capacity() * sizeof(uint8_t)
+                     + _keys.capacity() * sizeof(Digest)
+                     + _lists.capacity() * sizeof(uint32_t)
+                     + _postings.capacity() * sizeof(std::vector<size_t>);
+        for (auto const &list : _postings) {
+            bytes += list.capacity() * sizeof(size_t);
+        }
+        return bytes;
+    }
+
+    size_t InvertedIndex::groups() const {
+        return _control.size() / GROUP;
+    }
+
+    size_t InvertedIndex::findSlot(Digest const &key, uint64_t hash, bool &found) const {
+        return probe(_control.data(), _keys.data(), groups(), key, hash, found);
+    }
+
+    // Only the slot table moves, the posting lists stay where they are.
+    void InvertedIndex::rehash(size_t groups) {
+        std::vector<uint8_t> control(groups * GROUP, EMPTY);
+        std::vector<Digest> keys(groups * GROUP);
+        std::vector<uint32_t> lists(groups * GROUP);
+        control.swap(_control);
+        keys.swap(_keys);
+        lists.swap(_lists);
+        for (size_t i = 0; i != control.size(); ++i) {
+            if (control[i] == EMPTY) {
+                continue;
+            }
+            bool found;
+            size_t slot = findSlot(keys[i], keys[i].hash(), found);
+            _control[slot] = control[i];
+            _keys[slot] = keys[i];
+            _lists[slot] = lists[i];
+        }
+    }
+
+    FrozenIndex::FrozenIndex(std::string const &path):
+        _file(path)
+    {
+        std::runtime_error const invalid("Not a saved index: " + path);
+        if (_file.size() < HEADER_BYTES || std::memcmp(_file.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            throw invalid;
+        }
+        uint64_t fields[5];
+        std::memcpy(fields, _file.data() + sizeof(MAGIC), sizeof(fields));
+        _groups = fields[0];
+        _size = fields[1];
+        _postingCount = fields[2];
+        _documents = fields[3];
+
+        // each count is bounded by the file size before they are multiplied,
+        // so the size below cannot wrap around
+        size_t const bound = _file.size() / sizeof(uint64_t);
+        if (_groups == 0 || (_groups & (_groups - 1)) != 0 || _groups > bound
+            || _size >= bound || _postingCount > bound) {
+            throw invalid;
+        }
+        size_t slots = _groups * GROUP;
+        if (_file.size() != HEADER_BYTES + slots * (1 + sizeof(Digest) + sizeof(uint64_t))
+                            + (_size + 1 + _postingCount) * sizeof(uint64_t)
+            || fields[4] != recordChecksum(_file.data() + HEADER_BYTES,
+                                           _file.size() - HEADER_BYTES)) {
+            throw invalid;
+        }
+        // every section is a multiple of 8 bytes long, so the arrays of
+        // integers are aligned in the mapping
+        char const *data = _file.data() + HEADER_BYTES;
+        _control = reinterpret_cast<uint8_t const *>(data);
+        _keys = reinterpret_cast<Digest const *>(data += slots);
+        _lists = reinterpret_cast<uint64_t const *>(data += slots * sizeof(Digest));
+        _offsets = reinterpret_cast<uint64_t const *>(data += slots * sizeof(uint64_t));
+        _postings = reinterpret_cast<uint64_t const *>(data += (_size + 1) * sizeof(uint64_t));
+
+        // a probe stops at an empty slot, and a posting list must lie
+        // within the postings
+        bool empty = false;
+        for (size_t slot = 0; slot != slots; ++slot) {
+            if (_control[slot] == EMPTY) {
+                empty = true;
+            } else if (_lists[slot] >= _size) {
+                throw invalid;
+            }
+        }
+        if (!empty || _offsets[0] != 0 || _offsets[_size] != _postingCount) {
+            throw invalid;
+        }
+        for (size_t list = 0; list != _size; ++list) {
+            if (_offsets[list] > _offsets[list + 1]) {
+                throw invalid;
+            }
+        }
+    }
+
+    size_t FrozenIndex::documents() const {
+        return _documents;
+    }
+
+    size_t FrozenIndex::size() const {
+        return _size;
+    }
+
+    size_t FrozenIndex::postingCount() const {
+        return _postingCount;
+    }
+
+    std::pair<uint64_t const *, uint64_t const *> FrozenIndex::postings(Digest const &key) const {
+        bool found;
+        size_t slot = probe(_control, _keys, _groups, key, key.hash(), found);
+        if (!found) {
+            return {_postings, _postings};
+        }
+        return {_postings + _offsets[_lists[slot]], _postings + _offsets[_lists[slot] + 1]};
+    }
+
+    void FrozenIndex::appendTo(InvertedIndex &index) const {
+        index.reserve(index.size() + _size);
+        for (size_t slot = 0; slot != _groups * GROUP; ++slot) {
+            if (_control[slot] == EMPTY) {
+                continue;
+            }
+            auto range(postings(_keys[slot]));
+            for (auto it = range.first; it != range.second; ++it) {
+                index.append(_keys[slot], *it);
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "muse/mapped_file.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace muse {
+
+    MappedFile::MappedFile(std::string const &path):
+        _path(path),
+        _data(nullptr),
+        _size(0)
+    {
+        map();
+    }
+
+    MappedFile::~MappedFile() {
+        unmap();
+    }
+
+    void MappedFile::remap() {
+        unmap();
+        map();
+    }
+
+    char const *MappedFile::data() const {
+        return _data;
+    }
+
+    size_t MappedFile::size() const {
+        return _size;
+    }
+
+    // An empty file cannot be mapped, and is left with a null data().
+    void MappedFile::map() {
+        int fd = ::open(_path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + _path + ": " + std::strerror(errno));
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + _path + ": " + std::strerror(error));
+        }
+        _size = status.st_size;
+        if (_size != 0) {
+            void *data = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                _size = 0;
+                throw std::runtime_error("Cannot map " + _path + ": " + std::strerror(error));
+            }
+            _data = static_cast<char const *>(data);
+        }
+        // the mapping stays valid without the descriptor
+        ::close(fd);
+    }
+
+    void MappedFile::unmap() {
+        if (_data) {
+            ::munmap(const_cast<char *>(_data), _size);
+        }
+        _data = nullptr;
+        _size = 0;
+    }
+}
\ No newline at end of file
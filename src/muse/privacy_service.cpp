@@ -1,8 +1,12 @@
 #include "muse/privacy_service.h"
 
+#include <sstream>
+#include <stdexcept>
+
 #include "cryptopp/cmac.h"
 #include "cryptopp/aes.h"
 #include "cryptopp/filters.h"
+#include "helib/binio.h"
 
 
 namespace muse {
@@ -10,21 +14,44 @@ namespace muse {
     PrivacyService::PrivacyService(CryptoPP::RandomNumberGenerator &rng,
                                    HeAesCmac::SecurityParams const &heParams):
         _heContext(HeAesCmac::KeyPair::genContext(heParams)),
-        _heKeys(HeAesCmac::KeyPair::genKeyPair(_heContext, heParams.hwsk)),
+        _heKeys(HeAesCmac::KeyPair::genKeyPair(_heContext, heParams.hwsk,
+                                                     heParams.minimalKeys)),
         _hashKey(genAesKey(rng))
     {}
 
     PrivacyService::PrivacyService(std::vector<CryptoPP::byte> const &hashKey,
                                    HeAesCmac::SecurityParams const &heParams):
         _heContext(HeAesCmac::KeyPair::genContext(heParams)),
-        _heKeys(HeAesCmac::KeyPair::genKeyPair(_heContext, heParams.hwsk)),
+        _heKeys(HeAesCmac::KeyPair::genKeyPair(_heContext, heParams.hwsk,
+                                                     heParams.minimalKeys)),
         _hashKey(hashKey)
     {}
 
+    PrivacyService::PrivacyService(std::istream &in):
+        _heContext(HeAesCmac::KeyPair::readContext(in)),
+        _heKeys(HeAesCmac::KeyPair::read(in, _heContext)),
+        _hashKey(readAesKey(in))
+    {}
+
+    void PrivacyService::write(std::ostream &out) const {
+        HeAesCmac::KeyPair::writeContext(out, _heContext);
+        _heKeys.write(out);
+        helib::write_raw_int(out, _hashKey.size());
+        out.write(reinterpret_cast<char const *>(_hashKey.data()), _hashKey.size());
+    }
+
     HeAesCmac::PublicKey const &PrivacyService::hePk() const {
         return _heKeys.pk();
     }
 
+    void PrivacyService::setHeThreads(long n) {
+        _heKeys.pk().setThreads(n);
+    }
+
+    void PrivacyService::setHeSBox(std::shared_ptr<const SBoxEngine> engine) {
+        _heKeys.pk().setSBox(engine);
+    }
+
     void PrivacyService::computeHash(helib::Ctxt const &input, std::string &output) const {
         std::vector<CryptoPP::byte> inputPtxt;
         _heKeys.sk().decryptBlock(input, inputPtxt);
@@ -34,9 +61,69 @@ namespace muse {
             new CryptoPP::HashFilter(cmac, new CryptoPP::StringSink(output)));
     }
 
+    void PrivacyService::computeHash(std::string const &input, std::string &output) const {
+        computeHash(readCtxt(input), output);
+    }
+
+    void PrivacyService::computeHashBatch(std::vector<helib::Ctxt> const &input,
+                                          std::vector<std::string> &output) const {
+        std::vector<CryptoPP::byte> blocks;
+        blocks.reserve(input.size() * CryptoPP::AES::BLOCKSIZE);
+        for (auto const &ctxt : input) {
+            std::vector<CryptoPP::byte> block;
+            _heKeys.sk().decryptBlock(ctxt, block);
+            blocks.insert(blocks.end(), block.cbegin(), block.cend());
+        }
+        hashBlocks(blocks, output);
+    }
+
+    void PrivacyService::computeHashBatch(helib::Ctxt const &packed, size_t count,
+                                          std::vector<std::string> &output) const {
+        if (long(count) > _heKeys.pk().lanes()) {
+            throw std::invalid_argument("More CMACs than lanes in the ciphertext.");
+        }
+        std::vector<CryptoPP::byte> blocks;
+        _heKeys.sk().decryptLanes(packed, count, blocks);
+        hashBlocks(blocks, output);
+    }
+
+    void PrivacyService::computeHashBatch(std::string const &packed, size_t count,
+                                          std::vector<std::string> &output) const {
+        computeHashBatch(readCtxt(packed), count, output);
+    }
+
+    helib::Ctxt PrivacyService::readCtxt(std::string const &input) const {
+        std::istringstream in(input);
+        helib::Ctxt ctxt(_heKeys.pk().pk());
+        ctxt.read(in);
+        return ctxt;
+    }
+
+    // The CMAC object is built, and the key schedule expanded, once for all
+    // the blocks. Final() restarts it for the next one.
+    void PrivacyService::hashBlocks(std::vector<CryptoPP::byte> const &blocks,
+                                    std::vector<std::string> &output) const {
+        CryptoPP::CMAC<CryptoPP::AES> cmac(_hashKey.data(), _hashKey.size());
+        size_t count = blocks.size() / CryptoPP::AES::BLOCKSIZE;
+        output.assign(count, std::string(cmac.DigestSize(), '\0'));
+        for (size_t i = 0; i != count; ++i) {
+            cmac.Update(&blocks[i * CryptoPP::AES::BLOCKSIZE], CryptoPP::AES::BLOCKSIZE);
+            cmac.Final(reinterpret_cast<CryptoPP::byte *>(&output[i][0]));
+        }
+    }
+
     std::vector<CryptoPP::byte> PrivacyService::genAesKey(CryptoPP::RandomNumberGenerator &rng) {
         std::vector<CryptoPP::byte> key(CryptoPP::AES::DEFAULT_KEYLENGTH);
         rng.GenerateBlock(key.data(), key.size());
         return key;
     }
+
+    std::vector<CryptoPP::byte> PrivacyService::readAesKey(std::istream &in) {
+        std::vector<CryptoPP::byte> key(helib::read_raw_int(in));
+        in.read(reinterpret_cast<char *>(key.data()), key.size());
+        if (!in) {
+            throw std::runtime_error("Truncated PrivacyService data.");
+        }
+        return key;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "muse/reencryption_cache.h"
+
+#include <functional>
+
+namespace muse {
+
+    size_t ReencryptionCache::KeyHash::operator()(Key const &key) const {
+        return std::hash<size_t>()(key.first) * 31 + std::hash<size_t>()(key.second);
+    }
+
+    ReencryptionCache::ReencryptionCache(size_t capacity):
+        _capacity(capacity),
+        _hits(0),
+        _misses(0)
+    {}
+
+    size_t ReencryptionCache::capacity() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _capacity;
+    }
+
+    void ReencryptionCache::setCapacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _capacity = capacity;
+        while (_entries.size() > _capacity) {
+            erase(std::prev(_entries.end()));
+        }
+    }
+
+    std::shared_ptr<pre::ReencryptedCtxt const>
+        ReencryptionCache::find(size_t documentId, size_t recipientId, uint64_t version) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it(_index.find(Key(documentId, recipientId)));
+        if (it == _index.end() || it->second->_version != version) {
+            ++_misses;
+            return nullptr;
+        }
+        ++_hits;
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return it->second->_ctxt;
+    }
+
+    bool ReencryptionCache::contains(size_t documentId, size_t recipientId,
+                                     uint64_t version) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it(_index.find(Key(documentId, recipientId)));
+        return it != _index.end() && it->second->_version == version;
+    }
+
+    void ReencryptionCache::insert(size_t documentId, size_t recipientId, size_t ownerId,
+                                   uint64_t version,
+                                   std::shared_ptr<pre::ReencryptedCtxt const> ctxt) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_capacity == 0) {
+            return;
+        }
+        Key key(documentId, recipientId);
+        auto it(_index.find(key));
+        if (it != _index.end()) {
+            erase(it->second);
+        }
+        _entries.push_front({key, ownerId, version, ctxt});
+        _index.emplace(key, _entries.begin());
+        if (_entries.size() > _capacity) {
+            erase(std::prev(_entries.end()));
+        }
+    }
+
+    // Revocations are rare next to searches, so this scans the entries
+    // rather than keeping them by grant as well.
+    void ReencryptionCache::invalidate(size_t ownerId, size_t recipientId) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto it = _entries.begin(); it != _entries.end(); ) {
+            auto next(std::next(it));
+            if (it->_ownerId == ownerId && it->_key.second == recipientId) {
+                erase(it);
+            }
+            it = next;
+        }
+    }
+
+    size_t ReencryptionCache::size() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _entries.size();
+    }
+
+    size_t ReencryptionCache::hits() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _hits;
+    }
+
+    size_t ReencryptionCache::misses() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _misses;
+    }
+
+    void ReencryptionCache::erase(EntryList::iterator it) {
+        _index.erase(it->_key);
+        _entries.erase(it);
+    }
+}
\ No newline at end of file
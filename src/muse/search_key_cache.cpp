@@ -0,0 +1,61 @@
+#include "muse/search_key_cache.h"
+
+namespace muse {
+
+    SearchKeyCache::SearchKeyCache(size_t capacity):
+        _capacity(capacity),
+        _hits(0),
+        _misses(0)
+    {}
+
+    size_t SearchKeyCache::capacity() const {
+        return _capacity;
+    }
+
+    void SearchKeyCache::setCapacity(size_t capacity) {
+        _capacity = capacity;
+        while (_entries.size() > _capacity) {
+            _index.erase(_entries.back().first);
+            _entries.pop_back();
+        }
+    }
+
+    SearchKeyCtxt const *SearchKeyCache::find(std::string const &searchKey) {
+        auto it(_index.find(searchKey));
+        if (it == _index.end()) {
+            ++_misses;
+            return nullptr;
+        }
+        ++_hits;
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return &it->second->second;
+    }
+
+    void SearchKeyCache::insert(std::string const &searchKey, SearchKeyCtxt const &ctxt) {
+        if (_capacity == 0) {
+            return;
+        }
+        auto it(_index.find(searchKey));
+        if (it != _index.end()) {
+            _entries.erase(it->second);
+            _index.erase(it);
+        } else if (_entries.size() == _capacity) {
+            _index.erase(_entries.back().first);
+            _entries.pop_back();
+        }
+        _entries.emplace_front(searchKey, ctxt);
+        _index.emplace(searchKey, _entries.begin());
+    }
+
+    size_t SearchKeyCache::size() const {
+        return _entries.size();
+    }
+
+    size_t SearchKeyCache::hits() const {
+        return _hits;
+    }
+
+    size_t SearchKeyCache::misses() const {
+        return _misses;
+    }
+}
\ No newline at end of file
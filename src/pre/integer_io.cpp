@@ -0,0 +1,34 @@
+#include "pre/integer_io.h"
+
+#include <stdexcept>
+#include <vector>
+
+namespace pre {
+
+    void writeUint64(std::ostream &out, uint64_t value) {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(value));
+    }
+
+    uint64_t readUint64(std::istream &in) {
+        uint64_t value;
+        if (!in.read(reinterpret_cast<char *>(&value), sizeof(value))) {
+            throw std::runtime_error("Truncated integer.");
+        }
+        return value;
+    }
+
+    void writeInteger(std::ostream &out, CryptoPP::Integer const &value) {
+        std::vector<CryptoPP::byte> bytes(value.MinEncodedSize(CryptoPP::Integer::SIGNED));
+        value.Encode(bytes.data(), bytes.size(), CryptoPP::Integer::SIGNED);
+        writeUint64(out, bytes.size());
+        out.write(reinterpret_cast<char const *>(bytes.data()), bytes.size());
+    }
+
+    CryptoPP::Integer readInteger(std::istream &in) {
+        std::vector<CryptoPP::byte> bytes(readUint64(in));
+        if (!in.read(reinterpret_cast<char *>(bytes.data()), bytes.size())) {
+            throw std::runtime_error("Truncated integer.");
+        }
+        return CryptoPP::Integer(bytes.data(), bytes.size(), CryptoPP::Integer::SIGNED);
+    }
+}
\ No newline at end of file
@@ -73,7 +73,16 @@ namespace pre {
         return p;
     }
 
+    CryptoPP::AutoSeededRandomPool &PreScheme::rng() {
+        thread_local CryptoPP::AutoSeededRandomPool pool;
+        return pool;
+    }
+
+    unsigned const PreScheme::VALIDATION_EXPONENTIATIONS;
+
     PreScheme::PreScheme(size_t k1, size_t k2, size_t kp):
+        _validations(0),
+        _skippedValidations(0),
         _k1(k1),
         _k2(k2),
         _kp(kp)
@@ -82,8 +91,8 @@ namespace pre {
     KeyPair PreScheme::keyGen() {
 
         // p and q are safe primes of _kp bits
-        CryptoPP::Integer p(generateSafePrime(_rng, _kp));
-        CryptoPP::Integer q(generateSafePrime(_rng, _kp));
+        CryptoPP::Integer p(generateSafePrime(rng(), _kp));
+        CryptoPP::Integer q(generateSafePrime(rng(), _kp));
 
         // rMod = p * (p - 1) * q * (q - 1) / 4
         CryptoPP::Integer rMod(p);
@@ -95,8 +104,8 @@ namespace pre {
         SecretKey sk(
             p,
             q,
-            CryptoPP::Integer(_rng, CryptoPP::Integer::One(), rMod),
-            CryptoPP::Integer(_rng, CryptoPP::Integer::One(), rMod),
+            CryptoPP::Integer(rng(), CryptoPP::Integer::One(), rMod),
+            CryptoPP::Integer(rng(), CryptoPP::Integer::One(), rMod),
             rMod
         ); // a, b random in [1, rMod]
 
@@ -109,7 +118,7 @@ namespace pre {
         squaredN *= squaredN;
         
         // alpha random in [1, N ^ 2)
-        CryptoPP::Integer alpha(_rng, CryptoPP::Integer::One(), squaredN - 1);
+        CryptoPP::Integer alpha(rng(), CryptoPP::Integer::One(), squaredN - 1);
 
         // g0 = (alpha ^ 2) % (N ^ 2)
         CryptoPP::Integer g0(a_times_b_mod_c(alpha, alpha, squaredN));
@@ -125,8 +134,8 @@ namespace pre {
     }
 
     ReencryptionKey PreScheme::reKeyGen(SecretKey const &skx, PublicKey const &pky) {
-        CryptoPP::Integer sigma(_rng, CryptoPP::Integer::Zero(), pky.N() - CryptoPP::Integer::One());
-        CryptoPP::Integer beta(_rng, _k1);
+        CryptoPP::Integer sigma(rng(), CryptoPP::Integer::Zero(), pky.N() - CryptoPP::Integer::One());
+        CryptoPP::Integer beta(rng(), _k1);
 
         // r = H(sigma || beta, N_y ^ 2)
         CryptoPP::Integer r(hash(integerConcat({sigma, beta}), pky.squaredN()));
@@ -160,7 +169,7 @@ namespace pre {
     
     PrimaryCtxt PreScheme::encrypt(CryptoPP::Integer const &m, PublicKey const &pk) {
 
-        CryptoPP::Integer sigma(_rng, CryptoPP::Integer::Zero(), pk.N() - CryptoPP::Integer::One());
+        CryptoPP::Integer sigma(rng(), CryptoPP::Integer::Zero(), pk.N() - CryptoPP::Integer::One());
 
         // r = H(sigma || m, N ^ 2)
         CryptoPP::Integer r(hash(integerConcat({sigma, m}), pk.squaredN()));
@@ -184,7 +193,7 @@ namespace pre {
         CryptoPP::Integer D(a_exp_b_mod_c(pk.g2(), r, pk.squaredN()));
 
         // t random value with ((N ^ 2).BitCount() + _k2) bits
-        CryptoPP::Integer t(_rng, pk.squaredN().BitCount() + _k2);
+        CryptoPP::Integer t(rng(), pk.squaredN().BitCount() + _k2);
 
         // c = H(A || D || g0 || g2 || g0 ^ t || g2 ^ t || B || C, 2 ^ _k2)
         CryptoPP::Integer c(hash(integerConcat({
@@ -221,4 +230,12 @@ namespace pre {
     CryptoPP::Integer PreScheme::decrypt(Ctxt const &ctxt, PublicKey const &pk, SecretKey const &sk) {
         return ctxt.decrypt(*this, pk, sk);
     }
+
+    uint64_t PreScheme::validations() const {
+        return _validations;
+    }
+
+    uint64_t PreScheme::skippedValidations() const {
+        return _skippedValidations;
+    }
 }
\ No newline at end of file
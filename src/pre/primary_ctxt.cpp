@@ -1,4 +1,5 @@
 #include "pre/primary_ctxt.h"
+#include "pre/integer_io.h"
 #include "pre/pre_scheme.h"
 #include "pre/public_key.h"
 #include "pre/secret_key.h"
@@ -14,7 +15,19 @@ namespace pre {
         _C(C),
         _D(D),
         _c(c),
-        _s(s)
+        _s(s),
+        _validated(false)
+    {}
+
+    PrimaryCtxt::PrimaryCtxt(PrimaryCtxt const &other):
+        Ctxt(other),
+        _A(other._A),
+        _B(other._B),
+        _C(other._C),
+        _D(other._D),
+        _c(other._c),
+        _s(other._s),
+        _validated(other._validated.load())
     {}
             
     CryptoPP::Integer const &PrimaryCtxt::A() const {
@@ -41,7 +54,38 @@ namespace pre {
         return _s;
     }
 
+    void PrimaryCtxt::write(std::ostream &out) const {
+        writeUint64(out, ptxtBitSize());
+        pk().write(out);
+        for (auto const *value : {&_A, &_B, &_C, &_D, &_c, &_s}) {
+            writeInteger(out, *value);
+        }
+    }
+
+    PrimaryCtxt PrimaryCtxt::read(std::istream &in) {
+        size_t ptxtBitSize = readUint64(in);
+        PublicKey pk(PublicKey::read(in));
+        CryptoPP::Integer A(readInteger(in));
+        CryptoPP::Integer B(readInteger(in));
+        CryptoPP::Integer C(readInteger(in));
+        CryptoPP::Integer D(readInteger(in));
+        CryptoPP::Integer c(readInteger(in));
+        CryptoPP::Integer s(readInteger(in));
+        return PrimaryCtxt(ptxtBitSize, pk, A, B, C, D, c, s);
+    }
+
+    PrimaryCtxt PrimaryCtxt::readValidated(std::istream &in) {
+        PrimaryCtxt ctxt(read(in));
+        ctxt._validated = true;
+        return ctxt;
+    }
+
     void PrimaryCtxt::validate(PreScheme const &pre) const {
+        if (_validated) {
+            ++pre._skippedValidations;
+            return;
+        }
+        ++pre._validations;
         CryptoPP::Integer sAbs(_s.AbsoluteValue());
 
         // validC = H(A || D || g0 || g2 || (g0 ^ s) * (A ^ c) || (g2 ^ s) * (D ^ c) || B || C, 2 ^ _k2)
@@ -69,6 +113,11 @@ namespace pre {
         if (_c != validC) {
             throw Ctxt::INVALID_CTXT_ERROR;
         }
+        _validated = true;
+    }
+
+    bool PrimaryCtxt::isValidated() const {
+        return _validated;
     }
         
     CryptoPP::Integer PrimaryCtxt::decryptImpl(PreScheme const &pre, PublicKey const &pk, SecretKey const &sk) const {
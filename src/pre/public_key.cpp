@@ -1,4 +1,5 @@
 #include "pre/public_key.h"
+#include "pre/integer_io.h"
 
 namespace pre {
     PublicKey::PublicKey(CryptoPP::Integer const &N, CryptoPP::Integer const &g0,
@@ -30,4 +31,20 @@ namespace pre {
         return _g2;
     }
     
+    // N^2 is recomputed on read.
+    void PublicKey::write(std::ostream &out) const {
+        writeInteger(out, _N);
+        writeInteger(out, _g0);
+        writeInteger(out, _g1);
+        writeInteger(out, _g2);
+    }
+
+    PublicKey PublicKey::read(std::istream &in) {
+        CryptoPP::Integer N(readInteger(in));
+        CryptoPP::Integer g0(readInteger(in));
+        CryptoPP::Integer g1(readInteger(in));
+        CryptoPP::Integer g2(readInteger(in));
+        return PublicKey(N, g0, g1, g2);
+    }
+    
 }
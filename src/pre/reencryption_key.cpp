@@ -1,4 +1,5 @@
 #include "pre/reencryption_key.h"
+#include "pre/integer_io.h"
 
 namespace pre {
     ReencryptionKey::ReencryptionKey(CryptoPP::Integer const &A, CryptoPP::Integer const &B,
@@ -24,4 +25,19 @@ namespace pre {
     CryptoPP::Integer const &ReencryptionKey::R() const {
         return _R;
     }
+
+    void ReencryptionKey::write(std::ostream &out) const {
+        writeInteger(out, _A);
+        writeInteger(out, _B);
+        writeInteger(out, _C);
+        writeInteger(out, _R);
+    }
+
+    ReencryptionKey ReencryptionKey::read(std::istream &in) {
+        CryptoPP::Integer A(readInteger(in));
+        CryptoPP::Integer B(readInteger(in));
+        CryptoPP::Integer C(readInteger(in));
+        CryptoPP::Integer R(readInteger(in));
+        return ReencryptionKey(A, B, C, R);
+    }
 }